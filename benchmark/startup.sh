@@ -0,0 +1,31 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: Apache-2.0
+#
+# Compare the per-invocation startup cost of the runw client, which does not
+# link LLVM, with the runw-vm helper, which does. Both run `state` on a
+# container that does not exist, so the time is spent almost entirely in the
+# dynamic loader and in option parsing.
+#
+# Usage: benchmark/startup.sh [BUILD_DIR] [ITERATIONS]
+
+set -euo pipefail
+
+BUILD_DIR=${1:-build/src}
+ITERATIONS=${2:-1000}
+ROOT=$(mktemp -d)
+trap 'rm -rf "$ROOT"' EXIT
+
+bench() {
+  local Binary=$1
+  local Start End
+  Start=$(date +%s%N)
+  for ((I = 0; I < ITERATIONS; ++I)); do
+    "$Binary" --root "$ROOT" state runw-startup-benchmark >/dev/null 2>&1 || true
+  done
+  End=$(date +%s%N)
+  printf '%-8s %8d us per invocation\n' "$(basename "$Binary")" \
+    $(((End - Start) / ITERATIONS / 1000))
+}
+
+bench "$BUILD_DIR/runw"
+bench "$BUILD_DIR/runw-vm"
@@ -0,0 +1,63 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: Apache-2.0
+#
+# Measure the synchronous WASI I/O path of a container: the time the _start
+# export of BUNDLE runs, and the read and write syscalls the container issues
+# once started. Use a bundle whose module does the small fd_read and fd_write
+# calls of the workload, such as a log shipper reading stdin line by line.
+# Every WASI call is one syscall of runw-vm, so the syscall count is the
+# number any batching I/O backend has to beat.
+#
+# Usage: sudo benchmark/wasi-io.sh BUNDLE [BUILD_DIR] [ITERATIONS]
+
+set -euo pipefail
+
+BUNDLE=$(realpath "$1")
+BUILD_DIR=$(realpath "${2:-build/src}")
+ITERATIONS=${3:-20}
+# runw-vm logs how long each export ran here
+LOG=/tmp/runw.log
+ROOT=$(mktemp -d)
+trap 'rm -rf "$ROOT"' EXIT
+
+run() {
+  local Id=$1
+  "$BUILD_DIR/runw" --root "$ROOT" create --bundle "$BUNDLE" "$Id" >/dev/null
+  "$BUILD_DIR/runw" --root "$ROOT" start "$Id"
+  "$BUILD_DIR/runw" --root "$ROOT" wait "$Id" || true
+  "$BUILD_DIR/runw" --root "$ROOT" delete "$Id"
+}
+
+# The first run fills the AOT cache, so the timed runs do not compile
+run runw-wasi-io-warmup
+
+# Only the lines of the timed runs count, and of those only _start, without
+# create, the snapshot init export, start, wait and delete
+Offset=$(stat -c %s "$LOG" 2>/dev/null || echo 0)
+for ((I = 0; I < ITERATIONS; ++I)); do
+  run "runw-wasi-io-$I"
+done
+tail -c +$((Offset + 1)) "$LOG" |
+  sed -n 's/.*execute _start took \([0-9]*\)us.*/\1/p' |
+  awk '{ Sum += $1; ++Runs }
+       END { if (Runs) printf "_start    %8d us per run\n", Sum / Runs }'
+
+if command -v strace >/dev/null; then
+  # The container process waits on its exec fifo after create, so attach to
+  # it before start and detach when it exits
+  "$BUILD_DIR/runw" --root "$ROOT" create --bundle "$BUNDLE" runw-wasi-io-trace \
+    >/dev/null
+  Pid=$("$BUILD_DIR/runw" --root "$ROOT" state runw-wasi-io-trace |
+    sed -n 's/.*"pid": *\([0-9]*\).*/\1/p')
+  strace -f -c -e trace=read,write,readv,writev,pread64,pwrite64 \
+    -o "$ROOT/strace" -p "$Pid" &
+  Strace=$!
+  # Start only once strace traces the process, or the first calls are lost
+  until [[ $(sed -n 's/^TracerPid:\s*//p' "/proc/$Pid/status") != 0 ]]; do
+    kill -0 "$Strace"
+  done
+  "$BUILD_DIR/runw" --root "$ROOT" start runw-wasi-io-trace
+  wait "$Strace" || true
+  "$BUILD_DIR/runw" --root "$ROOT" delete runw-wasi-io-trace
+  cat "$ROOT/strace"
+fi
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <common/configure.h>
+#include <common/errcode.h>
+#include <common/filesystem.h>
+#include <common/span.h>
+#include <chrono>
+#include <ctime>
+#include <experimental/expected.hpp>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace RUNW {
+
+/// Node-wide AOT artifact cache.
+///
+/// Artifacts are shared by every container running the same module. They are
+/// keyed by the module content hash, the enabled proposals, the runtime
+/// version and the host CPU with its features. Containers hold a reference to
+/// the artifact they use instead of owning a private copy.
+class AOTCache {
+public:
+  /// Exclusive, cross-process lock on a single cache entry. Held by the
+  /// creator compiling the entry; other creators block on it and reuse the
+  /// published artifact. The kernel drops it if the holder dies.
+  class Lock {
+  public:
+    constexpr Lock() noexcept = default;
+    Lock(const Lock &RHS) noexcept = delete;
+    Lock &operator=(const Lock &RHS) noexcept = delete;
+    Lock(Lock &&RHS) noexcept : Fd(std::exchange(RHS.Fd, -1)) {}
+    Lock &operator=(Lock &&RHS) noexcept {
+      std::swap(Fd, RHS.Fd);
+      return *this;
+    }
+    ~Lock() noexcept;
+
+    int fd() const noexcept { return Fd; }
+
+  private:
+    friend class AOTCache;
+    constexpr Lock(int Fd) noexcept : Fd(Fd) {}
+
+    int Fd = -1;
+  };
+
+  struct Entry {
+    std::filesystem::path Path;
+    uint64_t Size = 0;
+    std::time_t LastUse = 0;
+    uint32_t References = 0;
+    bool Hot = false;
+  };
+
+  static std::string configKey(const WasmEdge::Configure &Conf);
+
+  /// Root directory of the node-wide cache.
+  static std::filesystem::path root();
+
+  static WasmEdge::Expect<std::filesystem::path>
+  getPath(WasmEdge::Span<const WasmEdge::Byte> Data,
+          const WasmEdge::Configure &Conf);
+
+  /// Lock a cache entry. Without Wait, fail with EWOULDBLOCK instead of
+  /// blocking while another process holds it. Shared locks are held from
+  /// verifying an artifact until the reference on it is taken; cache gc
+  /// evicts only under the exclusive lock.
+  static cxx20::expected<Lock, int> lock(const std::filesystem::path &SoPath,
+                                         bool Wait = true,
+                                         bool Shared = false) noexcept;
+
+  static cxx20::expected<void, int>
+  acquire(const std::filesystem::path &SoPath,
+          const std::filesystem::path &ContainerRoot) noexcept;
+
+  static cxx20::expected<void, int>
+  release(const std::filesystem::path &ContainerRoot) noexcept;
+
+  /// Record that the module behind SoPath passed validation under Conf,
+  /// together with the identity of the artifact file at TempPath that is
+  /// about to be published there.
+  static cxx20::expected<void, int>
+  recordVerdict(const std::filesystem::path &SoPath,
+                const std::filesystem::path &TempPath,
+                const WasmEdge::Configure &Conf) noexcept;
+
+  /// Check that SoPath holds a published artifact with a matching verdict.
+  static bool verify(const std::filesystem::path &SoPath,
+                     const WasmEdge::Configure &Conf) noexcept;
+
+  /// Find the artifact of a module without reading it. The index is keyed by
+  /// the file identity of WasmPath (device, inode, size, mtime and ctime),
+  /// which the bundle cannot choose. On a hit, Shared holds the entry lock
+  /// shared until the caller has taken its reference.
+  static std::optional<std::filesystem::path>
+  lookup(const std::filesystem::path &WasmPath,
+         const WasmEdge::Configure &Conf, Lock &Shared) noexcept;
+
+  /// Point the index entry of WasmPath at SoPath, the artifact of the content
+  /// that was just read from it.
+  static void index(const std::filesystem::path &WasmPath,
+                    const WasmEdge::Configure &Conf,
+                    const std::filesystem::path &SoPath) noexcept;
+
+  /// Add a run of the module behind SoPath to its recorded run time.
+  static void recordRun(const std::filesystem::path &SoPath,
+                        std::chrono::nanoseconds RunTime) noexcept;
+
+  /// Total run time recorded for the module behind SoPath.
+  static std::chrono::nanoseconds
+  runTime(const std::filesystem::path &SoPath) noexcept;
+
+  /// Path to load a verified artifact from: its copy in the hot tier when
+  /// that copy matches its own verdict, SoPath otherwise.
+  static std::filesystem::path locate(const std::filesystem::path &SoPath,
+                                      const WasmEdge::Configure &Conf);
+
+  /// Remove the per-container caches older releases left under the cache
+  /// root, once per node. Their delete cleared them, and the delete of the
+  /// runw client no longer links the cache code that knows where they are.
+  static void migrate() noexcept;
+
+  /// List cache entries. References of containers that no longer exist under
+  /// ContainerDir are not counted, and are removed when Prune is set.
+  static std::vector<Entry> list(const std::filesystem::path &ContainerDir,
+                                 bool Prune = false);
+
+  /// Evict least recently used, unreferenced entries until the cache fits in
+  /// MaxSize bytes, then keep the most recently used entries that fit in
+  /// HotSize bytes in the tmpfs hot tier. A zero size disables the limit.
+  static cxx20::expected<void, int>
+  collect(const std::filesystem::path &ContainerDir, uint64_t MaxSize,
+          uint64_t HotSize) noexcept;
+
+  /// Directory of the references containers hold on SoPath. Defined with
+  /// acquire and release, apart from the rest of the cache, so lifecycle
+  /// verbs can release references without linking the runtime.
+  static std::filesystem::path
+  referenceDir(const std::filesystem::path &SoPath);
+
+private:
+  static std::filesystem::path hotPath(const std::filesystem::path &SoPath);
+  static std::filesystem::path indexPath(const std::filesystem::path &WasmPath,
+                                         const WasmEdge::Configure &Conf);
+};
+
+} // namespace RUNW
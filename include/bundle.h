@@ -27,6 +27,16 @@ public:
   cxx20::span<const std::string> cmds() const noexcept { return Cmds; }
   std::string_view rootPath() const noexcept { return RootPath; }
   std::string_view linuxCgroupsPath() const noexcept { return CgroupsPath; }
+  std::string_view linuxResourcesCpuCpus() const noexcept {
+    return ResourcesCpuCpus;
+  }
+  bool tieredExecution() const noexcept { return TieredExecution; }
+  bool recordRunTime() const noexcept { return RecordRunTime; }
+  std::string_view snapshotInit() const noexcept { return SnapshotInit; }
+  std::string_view hostName() const noexcept { return HostName; }
+  std::string_view sandboxId() const noexcept { return SandboxId; }
+  uint32_t outputBufferSize() const noexcept { return OutputBufferSize; }
+  uint32_t outputFlushInterval() const noexcept { return OutputFlushInterval; }
   cxx20::span<const NamespaceDesc> linuxNamespaces() const noexcept {
     return Namespaces;
   }
@@ -127,6 +137,16 @@ private:
   std::string CgroupsPath{};
   uint64_t ResourcesMemoryLimit{};
   uint64_t ResourcesMemoryReservation{};
+  std::string ResourcesCpuCpus{};
+
+  // Annotations
+  bool TieredExecution = false;
+  bool RecordRunTime = false;
+  std::string SnapshotInit{};
+  std::string HostName{};
+  std::string SandboxId{};
+  uint32_t OutputBufferSize{};
+  uint32_t OutputFlushInterval = 100;
 };
 
 } // namespace RUNW
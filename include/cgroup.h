@@ -1,8 +1,11 @@
 // SPDX-License-Identifier: Apache-2.0
 #pragma once
 
+#include <cstdint>
 #include <experimental/expected.hpp>
+#include <string>
 #include <string_view>
+#include <sys/types.h>
 
 namespace RUNW {
 
@@ -15,9 +18,39 @@ public:
     Legacy,
     Hybird,
   };
+  /// Resource budget of an AOT compile. Zero fields are left unlimited.
+  struct Resources {
+    uint64_t CPUWeight = 0;
+    uint64_t CPUQuotaPercent = 0;
+    uint64_t MemoryMax = 0;
+    bool limited() const noexcept {
+      return CPUWeight != 0 || CPUQuotaPercent != 0 || MemoryMax != 0;
+    }
+  };
   static cxx20::expected<void, int> enter(std::string_view ContainerId,
                                           const State &State) noexcept;
 
+  /// Whether cgroups are on the unified hierarchy, where processes can be
+  /// spawned into a cgroup.
+  static bool unified() noexcept { return CGroupMode == Mode::Unified; }
+
+  /// Start the scope of the container with Pid in it, a placeholder that
+  /// keeps the scope alive until the container process joins.
+  static cxx20::expected<void, int> prepare(std::string_view ContainerId,
+                                            const State &State,
+                                            pid_t Pid) noexcept;
+
+  /// Open the cgroup of Pid, to spawn the container process into with
+  /// CLONE_INTO_CGROUP or to move it into with join.
+  static cxx20::expected<int, int> target(pid_t Pid) noexcept;
+
+  /// Move Pid into the cgroup opened by target.
+  static cxx20::expected<void, int> join(int Fd, pid_t Pid) noexcept;
+
+  /// Move Pid into a transient scope of its own, limited by Limits.
+  static cxx20::expected<void, int> enterCompile(pid_t Pid,
+                                                 const Resources &Limits) noexcept;
+
   static cxx20::expected<void, int> finalize(const State &State);
 
 private:
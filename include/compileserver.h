@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <common/filesystem.h>
+#include <experimental/expected.hpp>
+#include <functional>
+
+namespace RUNW {
+
+/// Node-local AOT compile service.
+///
+/// Creates submit compile jobs over a Unix socket instead of forking their
+/// own compiler. The service runs at most a fixed number of compiles at once,
+/// in request order and at low CPU priority, and merges requests for the
+/// same artifact into one job.
+class CompileServer {
+public:
+  using CompileFunc = std::function<bool(const std::filesystem::path &)>;
+
+  static std::filesystem::path socketPath();
+
+  /// Serve requests until interrupted. Compile runs in a forked worker and
+  /// gets the path of the wasm module to compile.
+  static cxx20::expected<void, int> serve(uint32_t Jobs,
+                                          CompileFunc Compile) noexcept;
+
+  /// Ask the service to compile WasmPath into SoPath. With Wait set, block
+  /// until the artifact is published. Fails with ENOENT or ECONNREFUSED when
+  /// no service is running.
+  static cxx20::expected<void, int>
+  request(const std::filesystem::path &SoPath,
+          const std::filesystem::path &WasmPath, bool Wait) noexcept;
+};
+
+} // namespace RUNW
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <common/filesystem.h>
+#include <experimental/expected.hpp>
+#include <functional>
+
+namespace RUNW {
+
+/// Long-lived server of the OCI verbs.
+///
+/// Every runw invocation maps LLVM and the WasmEdge libraries, opens its log
+/// and probes the cgroup hierarchy before doing any work. While the daemon
+/// runs, the client forwards its command line, working directory,
+/// environment, umask, resource limits and stdio to it, and the command runs
+/// in a worker forked off the daemon, which has all of that done already.
+/// The worker stays in the cgroup of the daemon, and processes it leaves
+/// behind are orphaned to the reaper of the daemon, not of the client.
+class Daemon {
+public:
+  /// Runs in the forked worker, with the stdio and working directory of the
+  /// client. Returns the exit code of the command.
+  using RunFunc = std::function<int(int Argc, const char *Argv[])>;
+
+  static std::filesystem::path socketPath();
+
+  /// Serve requests until killed.
+  static cxx20::expected<void, int> serve(RunFunc Run) noexcept;
+
+  /// Run the command line in the daemon and return its exit code. Fails with
+  /// ENOENT or ECONNREFUSED when no daemon is running, and only when the
+  /// command has not been handed to the daemon.
+  static cxx20::expected<int, int> forward(int Argc,
+                                           const char *Argv[]) noexcept;
+};
+
+} // namespace RUNW
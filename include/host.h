@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <common/filesystem.h>
+#include <experimental/expected.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace RUNW {
+
+/// Process running many containers as threads.
+///
+/// Containers whose bundle names a host in the org.wasmedge.host annotation
+/// are created as instances of that host instead of processes of their own.
+/// Each instance has its own VM, WASI environment, state file and exit code,
+/// and shares the runtime libraries, the heap, the log and the namespaces
+/// and cgroup of the host, so a host only takes the containers of one pod:
+/// the sandbox and pod cgroup of the first container it runs, in none but the
+/// namespaces of the host. The others start as processes of their own.
+class Host {
+public:
+  struct Request {
+    std::filesystem::path ContainerRoot;
+    std::string ContainerId;
+    std::string PidFile;
+    std::string ConfigFileName;
+    int ExecFifoFd = -1;
+  };
+  /// Runs in the thread of the instance before the create returns. Returns
+  /// the loaded instance, or nullptr when the host cannot run the container.
+  using PrepareFunc = std::function<std::shared_ptr<void>(const Request &)>;
+  /// Runs the prepared instance in its thread. Returns the exit code of the
+  /// container.
+  using RunFunc = std::function<int(const Request &, void *Instance)>;
+  /// Runs in the thread serving the host when an instance is killed, with
+  /// Run still going in the thread of the instance. Only asks Run to return.
+  using StopFunc = std::function<void(void *Instance)>;
+  /// Runs in the thread of an instance that was killed, to record the exit
+  /// code of the signal over the one Run returned.
+  using KillFunc = std::function<void(const Request &, int ExitCode)>;
+
+  static std::filesystem::path socketPath(std::string_view Name);
+
+  /// Serve the host Name until killed.
+  static cxx20::expected<void, int> serve(std::string_view Name,
+                                          PrepareFunc Prepare, RunFunc Run,
+                                          StopFunc Stop,
+                                          KillFunc Kill) noexcept;
+
+  /// Whether the instance running in the calling thread was killed. Its
+  /// blocking calls fail with EINTR once it is, and Run returns on that.
+  static bool stopping() noexcept;
+
+  /// Ask the host Name to run the container. Fails with ENOENT or
+  /// ECONNREFUSED when the host is not running, and with EAGAIN when it
+  /// cannot run the container.
+  static cxx20::expected<void, int> request(std::string_view Name,
+                                            const Request &Req) noexcept;
+
+  /// Send a signal to the container, when it is an instance of a host.
+  /// Fails with ENOENT when it is not, and with ESRCH when it has exited.
+  static cxx20::expected<void, int>
+  kill(const std::filesystem::path &ContainerRoot,
+       std::string_view ContainerId, int Signal) noexcept;
+
+  /// Block until the container exits, when it is an instance of a host, and
+  /// return its exit code. Fails with ENOENT when it is not, and with ESRCH
+  /// when it has exited already.
+  static cxx20::expected<int, int>
+  wait(const std::filesystem::path &ContainerRoot,
+       std::string_view ContainerId) noexcept;
+};
+
+} // namespace RUNW
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include "defines.h"
+#include "state.h"
+#include <experimental/expected.hpp>
+#include <string_view>
+
+namespace RUNW {
+
+class Options;
+
+/// OCI verbs on containers that already exist.
+///
+/// They only touch the container state, its fifo and its process, and need
+/// neither the VM nor the AOT compiler. The runw client, the runw-vm helper
+/// and librunw all run them. Failures are reported as errno values.
+class Lifecycle {
+public:
+  static cxx20::expected<void, int> remove(std::string_view Root,
+                                           std::string_view ContainerId,
+                                           bool Force) noexcept;
+  static cxx20::expected<void, int> kill(std::string_view Root,
+                                         std::string_view ConfigFileName,
+                                         std::string_view ContainerId,
+                                         int Signal) noexcept;
+  /// Block until the container process exits, and return its exit code.
+  static cxx20::expected<int, int> wait(std::string_view Root,
+                                        std::string_view ConfigFileName,
+                                        std::string_view ContainerId) noexcept;
+  static cxx20::expected<void, int>
+  start(std::string_view Root, std::string_view ConfigFileName,
+        std::string_view ContainerId) noexcept;
+  static cxx20::expected<State, int>
+  state(std::string_view Root, std::string_view ConfigFileName,
+        std::string_view ContainerId) noexcept;
+
+  /// Signal number of a name like "SIGTERM", "term" or "15", or -1.
+  static int parseSignal(std::string_view Name) noexcept;
+
+  /// Run the selected verb of a runw command line and return its exit code.
+  static int command(const Options &Opts) noexcept;
+};
+
+} // namespace RUNW
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include "cgroup.h"
+#include <cstdint>
+#include <po/argument_parser.h>
+#include <po/list.h>
+#include <po/option.h>
+#include <po/subcommand.h>
+#include <string>
+
+namespace RUNW {
+
+/// Command line of runw.
+///
+/// The runw client and the runw-vm helper both parse it, so a command line
+/// the client hands to the helper means the same to both.
+class Options {
+public:
+  Options();
+  Options(const Options &) = delete;
+  Options &operator=(const Options &) = delete;
+
+  /// Parse the command line. Fails on malformed arguments.
+  bool parse(int Argc, const char *Argv[]);
+
+  /// True when the selected subcommand acts on an existing container and
+  /// needs neither the VM nor the AOT compiler.
+  bool isLifecycle() const noexcept;
+
+  CGroup::Resources compileLimits() const noexcept;
+
+  WasmEdge::PO::SubCommand Create;
+  WasmEdge::PO::SubCommand Delete;
+  WasmEdge::PO::SubCommand Kill;
+  WasmEdge::PO::SubCommand Start;
+  WasmEdge::PO::SubCommand State;
+  WasmEdge::PO::SubCommand Wait;
+  WasmEdge::PO::SubCommand Cache;
+  WasmEdge::PO::SubCommand Precompile;
+  WasmEdge::PO::SubCommand Snapshot;
+  WasmEdge::PO::SubCommand Zygote;
+  WasmEdge::PO::SubCommand Host;
+  WasmEdge::PO::SubCommand CompileServer;
+  WasmEdge::PO::SubCommand Daemon;
+
+  WasmEdge::PO::Option<std::string> Root;
+  WasmEdge::PO::Option<WasmEdge::PO::Toggle> SystemdCgroup;
+  WasmEdge::PO::Option<std::string> ConfigFileName;
+  WasmEdge::PO::Option<WasmEdge::PO::Toggle> UseServices;
+
+  WasmEdge::PO::Option<uint64_t> AOTCpuWeight;
+  WasmEdge::PO::Option<uint64_t> AOTCpuMax;
+  WasmEdge::PO::Option<uint64_t> AOTMemoryMax;
+
+  WasmEdge::PO::Option<std::string> ContainerId;
+  WasmEdge::PO::Option<std::string> Path;
+  WasmEdge::PO::Option<std::string> ConsoleSocket;
+  WasmEdge::PO::Option<std::string> PidFile;
+
+  WasmEdge::PO::Option<WasmEdge::PO::Toggle> Force;
+
+  WasmEdge::PO::Option<std::string> Signal;
+
+  WasmEdge::PO::Option<std::string> SnapshotBundle;
+  WasmEdge::PO::List<std::string> PrecompilePaths;
+  WasmEdge::PO::Option<std::string> CacheAction;
+  WasmEdge::PO::Option<uint64_t> MaxSize;
+  WasmEdge::PO::Option<uint64_t> HotSize;
+  WasmEdge::PO::Option<uint32_t> Jobs;
+  WasmEdge::PO::Option<uint32_t> MaxInstances;
+  WasmEdge::PO::Option<std::string> HostName;
+  WasmEdge::PO::Option<WasmEdge::PO::Toggle> HottestFirst;
+
+  WasmEdge::PO::ArgumentParser Parser;
+};
+
+} // namespace RUNW
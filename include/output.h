@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <experimental/expected.hpp>
+#include <thread>
+
+namespace RUNW {
+
+/// Coalescing stage between stdout and stderr of the guest and the fds the
+/// container inherited, usually the log pipe of conmon.
+///
+/// The guest writes into a pipe of the stage, twice BufferSize large, which
+/// holds the output until it is due. A thread looks at the pipes four times
+/// per FlushInterval instead of waking on every write, and splices a pipe to
+/// the inherited fd once it holds BufferSize bytes, once its oldest bytes are
+/// FlushInterval old, when the stage stops and when the process gets
+/// SIGTERM. The reader of the log then wakes once per batch instead of once
+/// per line. While the guest fills a batch between two looks, the thread
+/// looks more often, so a fast guest does not block on a full pipe.
+class OutputStage {
+public:
+  OutputStage() = default;
+  OutputStage(const OutputStage &) = delete;
+  OutputStage &operator=(const OutputStage &) = delete;
+  ~OutputStage() noexcept { stop(); }
+
+  /// Route stdout and stderr of the process through the stage.
+  cxx20::expected<void, int>
+  start(uint32_t BufferSize, std::chrono::milliseconds FlushInterval) noexcept;
+
+  /// Flush everything the guest wrote and give stdout and stderr back their
+  /// inherited fds.
+  void stop() noexcept;
+
+private:
+  struct Stream {
+    /// Inherited fd the output goes to
+    int Target = -1;
+    /// Read end of the pipe the guest writes to
+    int In = -1;
+    /// Bytes that make a batch, at most half of what the pipe holds
+    size_t Threshold = 0;
+    /// Bytes in the pipe when last looked at, and since when it held any
+    size_t Size = 0;
+    std::chrono::steady_clock::time_point Since;
+    /// Cleared when Target does not take splice, like a terminal
+    bool Splice = true;
+  };
+
+  void relay() noexcept;
+  void flush(Stream &S) noexcept;
+  void closeAll() noexcept;
+
+  std::array<Stream, 2> Streams;
+  std::chrono::milliseconds FlushInterval{};
+  int StopFd = -1;
+  std::thread Thread;
+};
+
+} // namespace RUNW
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <common/filesystem.h>
+#include <experimental/expected.hpp>
+#include <sys/types.h>
+
+namespace RUNW {
+
+/// Race free handles of container processes.
+///
+/// A pidfd refers to one process for its whole life, so signals sent through
+/// it never reach a process that reused the pid. The pidfd of a container is
+/// opened when the process is spawned and kept by a small holder process,
+/// which hands duplicates to kill and wait and exits with the container.
+class PidFd {
+public:
+  static cxx20::expected<int, int> open(pid_t Pid) noexcept;
+  static cxx20::expected<void, int> sendSignal(int Fd, int Signal) noexcept;
+
+  /// Start a holder of Fd, serving it on a socket in ContainerRoot. Fd stays
+  /// owned by the caller.
+  static cxx20::expected<void, int>
+  hold(int Fd, const std::filesystem::path &ContainerRoot) noexcept;
+
+  /// Hand Fd to every connection on ListenFd until its process exits. This
+  /// is the main loop of the runw-pidfd holder.
+  static void serve(int Fd, int ListenFd) noexcept;
+
+  /// Open the pidfd of Pid and start its holder.
+  static cxx20::expected<void, int>
+  track(pid_t Pid, const std::filesystem::path &ContainerRoot) noexcept;
+
+  /// Get the pidfd of the container from its holder. Fails with ENOENT when
+  /// the container was started without a holder, and with ECONNREFUSED once
+  /// the holder has exited with the container.
+  static cxx20::expected<int, int>
+  connect(const std::filesystem::path &ContainerRoot) noexcept;
+};
+
+} // namespace RUNW
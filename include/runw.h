@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+/// librunw: the OCI verbs of runw for shims that drive many containers.
+///
+/// Functions returning int return 0 on success and an errno value on failure.
+/// Handles are opaque, strings returned by accessors live as long as the
+/// handle they came from. The library does not log.
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#if defined(__GNUC__)
+#define RUNW_API __attribute__((visibility("default")))
+#else
+#define RUNW_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct runw_context runw_context;
+typedef struct runw_state runw_state;
+typedef struct runw_bundle runw_bundle;
+
+typedef enum runw_status {
+  RUNW_STATUS_UNKNOWN = 0,
+  RUNW_STATUS_CREATING = 1,
+  RUNW_STATUS_CREATED = 2,
+  RUNW_STATUS_RUNNING = 3,
+  RUNW_STATUS_STOPPED = 4,
+} runw_status;
+
+/// Fields are only ever appended. A caller sets size to the sizeof of the
+/// struct it was built with, and the library reads the fields that size
+/// covers and takes the others as zero.
+typedef struct runw_create_options {
+  /// sizeof(runw_create_options) as the caller knows it
+  size_t size;
+  /// File to write the container process id to, or NULL
+  const char *pid_file;
+  /// Socket receiving the console pseudoterminal, or NULL
+  const char *console_socket;
+  /// Nonzero when cgroupsPath has the form "slice:prefix:name"
+  int systemd_cgroup;
+  /// Nonzero to let the runw daemon, a zygote or a host create the container
+  /// process, which leaves it a child of theirs that the caller cannot wait
+  /// for. Leave it zero in a subreaper.
+  int use_services;
+} runw_create_options;
+
+RUNW_API const char *runw_version(void);
+
+/// Containers live under root, NULL for the default of runw. create runs
+/// helper, NULL for runw-vm from PATH.
+RUNW_API int runw_context_new(const char *root, const char *helper,
+                              runw_context **context);
+RUNW_API void runw_context_free(runw_context *context);
+/// Name of the bundle configuration file, config.json by default.
+RUNW_API int runw_context_set_config(runw_context *context,
+                                     const char *config_file_name);
+
+/// Create a container from a bundle. Compiling and instantiating the module
+/// needs the VM, so this is the only call that leaves the process: it is
+/// handed to the runw daemon when one runs and use_services is set, and to
+/// the helper otherwise.
+/// Fails with EEXIST when the container exists, with ENOENT when the bundle
+/// does not, with EINVAL when its configuration does not load, with ECHILD
+/// when the helper was killed, and with EIO when the create itself failed,
+/// as logged by runw. options may be NULL.
+RUNW_API int runw_create(runw_context *context, const char *id,
+                         const char *bundle,
+                         const runw_create_options *options);
+RUNW_API int runw_start(runw_context *context, const char *id);
+/// Fails with ESRCH when the container process has exited.
+RUNW_API int runw_kill(runw_context *context, const char *id, int signal);
+RUNW_API int runw_delete(runw_context *context, const char *id, int force);
+/// Block until the container process exits, and store its exit code.
+RUNW_API int runw_wait(runw_context *context, const char *id, int *exit_code);
+
+RUNW_API int runw_state_load(runw_context *context, const char *id,
+                             runw_state **state);
+RUNW_API void runw_state_free(runw_state *state);
+RUNW_API const char *runw_state_id(const runw_state *state);
+RUNW_API runw_status runw_state_status(const runw_state *state);
+/// -1 unless the container is created or running
+RUNW_API pid_t runw_state_pid(const runw_state *state);
+/// 0 unless the container is stopped
+RUNW_API int runw_state_exit_code(const runw_state *state);
+RUNW_API const char *runw_state_bundle_path(const runw_state *state);
+/// RFC 3339 timestamps, empty before the container reaches the stage
+RUNW_API const char *runw_state_created(const runw_state *state);
+RUNW_API const char *runw_state_started(const runw_state *state);
+RUNW_API const char *runw_state_finished(const runw_state *state);
+/// Bundle of the container, owned by state
+RUNW_API const runw_bundle *runw_state_bundle(const runw_state *state);
+
+RUNW_API int runw_bundle_load(const char *path, const char *config_file_name,
+                              runw_bundle **bundle);
+RUNW_API void runw_bundle_free(runw_bundle *bundle);
+RUNW_API const char *runw_bundle_root_path(const runw_bundle *bundle);
+RUNW_API const char *runw_bundle_cwd(const runw_bundle *bundle);
+RUNW_API size_t runw_bundle_arg_count(const runw_bundle *bundle);
+RUNW_API const char *runw_bundle_arg(const runw_bundle *bundle, size_t index);
+RUNW_API size_t runw_bundle_env_count(const runw_bundle *bundle);
+RUNW_API const char *runw_bundle_env(const runw_bundle *bundle, size_t index);
+RUNW_API const char *runw_bundle_cgroups_path(const runw_bundle *bundle);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <common/filesystem.h>
+#include <experimental/expected.hpp>
+#include <string_view>
+
+namespace WasmEdge::VM {
+class VM;
+} // namespace WasmEdge::VM
+
+namespace RUNW {
+
+/// Pre-initialized instance state.
+///
+/// A snapshot holds the linear memories and mutable globals of an instance
+/// after its initialization export returned, or right after instantiation for
+/// modules without one. It is stored next to the AOT artifact of the module.
+/// Restoring it into a freshly instantiated VM replaces running the
+/// initialization export, and maps the memory contents copy-on-write from the
+/// snapshot file, so replicas share the pages they do not write.
+class Snapshot {
+public:
+  static std::filesystem::path path(const std::filesystem::path &SoPath);
+
+  /// Run the Init export of an instantiated VM, if any, and save the
+  /// resulting state.
+  static cxx20::expected<void, int>
+  capture(WasmEdge::VM::VM &VM, std::string_view Init,
+          const std::filesystem::path &SoPath) noexcept;
+
+  /// Restore the state saved by capture into an instantiated VM. Fails with
+  /// ENOENT when there is no snapshot, with ESTALE when it was taken with
+  /// another initialization export or by another runw version, and with
+  /// EINVAL when it does not fit the module. The instance is untouched then
+  /// and can still run the initialization export. On ENOMEM some memories may
+  /// have grown, and the instance has to be dropped.
+  static cxx20::expected<void, int>
+  restore(WasmEdge::VM::VM &VM, std::string_view Init,
+          const std::filesystem::path &SoPath) noexcept;
+};
+
+} // namespace RUNW
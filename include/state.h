@@ -38,8 +38,21 @@ public:
   bool loadBundle(std::string_view ConfigFileName);
   void print(std::ostream &Stream) const;
 
+  std::string_view containerId() const noexcept { return ContainerId; }
+  std::string_view createdTimestamp() const noexcept {
+    return CreatedTimestamp;
+  }
+  std::string_view startedTimestamp() const noexcept {
+    return StartedTimestamp;
+  }
+  std::string_view finishedTimestamp() const noexcept {
+    return FinishedTimestamp;
+  }
   pid_t getPid() const noexcept { return Pid; }
+  StatusCode getStatus() const noexcept { return Status; }
+  int getExitCode() const noexcept { return ExitCode; }
   const Bundle &bundle() const noexcept { return Config; }
+  std::string_view bundlePath() const noexcept { return BundlePath; }
   void setCreating() noexcept;
   void setCreated() noexcept;
   void setRunning() noexcept;
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <common/filesystem.h>
+#include <experimental/expected.hpp>
+
+namespace RUNW {
+
+/// Unix sockets the runw services listen on and their clients connect to.
+///
+/// The services run as root and act on what they are sent, so a listening
+/// socket is connectable by its owner only from the moment it is bound, and
+/// each connection is checked against the credentials of its peer.
+class UnixSocket {
+public:
+  /// Listen on Path with a socket of Type, replacing any socket left there.
+  /// Returns the listening fd.
+  static cxx20::expected<int, int> listen(const std::filesystem::path &Path,
+                                          int Type) noexcept;
+
+  /// Connect to the socket at Path with a socket of Type. Fails with ENOENT
+  /// or ECONNREFUSED when nothing listens there.
+  static cxx20::expected<int, int> connect(const std::filesystem::path &Path,
+                                           int Type) noexcept;
+
+  /// Whether the peer of the connection Fd is root or the user running the
+  /// service, the only ones who may hand it requests.
+  static bool trustedPeer(int Fd) noexcept;
+};
+
+} // namespace RUNW
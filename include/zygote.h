@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <common/filesystem.h>
+#include <experimental/expected.hpp>
+#include <functional>
+#include <string>
+
+namespace RUNW {
+
+/// Fork server for container processes.
+///
+/// The zygote keeps instantiated VMs of modules it has seen. Creates hand it
+/// their container, and it forks the container process off a warm VM instead
+/// of loading, validating and instantiating the module again.
+class Zygote {
+public:
+  struct Request {
+    std::filesystem::path ContainerRoot;
+    std::string ContainerId;
+    std::string PidFile;
+    std::string ConfigFileName;
+    int ExecFifoFd = -1;
+  };
+  /// Runs in the zygote before forking. Returns false when the request cannot
+  /// be served from a warm VM.
+  using PrepareFunc = std::function<bool(const Request &)>;
+  /// Runs in the forked container process, with the stdio of the create.
+  using RunFunc = std::function<int(const Request &)>;
+
+  static std::filesystem::path socketPath();
+
+  /// Serve requests until killed.
+  static cxx20::expected<void, int> serve(PrepareFunc Prepare,
+                                          RunFunc Run) noexcept;
+
+  /// Ask the zygote to start the container. Fails with ENOENT or
+  /// ECONNREFUSED when no zygote is running, and with EAGAIN when the zygote
+  /// cannot serve the container.
+  static cxx20::expected<void, int> request(const Request &Req) noexcept;
+};
+
+} // namespace RUNW
@@ -0,0 +1,581 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "aotcache.h"
+#include "config.h"
+#include "snapshot.h"
+#include <aot/cache.h>
+#include <algorithm>
+#include <array>
+#include <boost/scope_exit.hpp>
+#include <chrono>
+#include <cinttypes>
+#include <common/log.h>
+#include <cstdio>
+#include <fstream>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Host.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+const std::string_view kLockSuffix = ".lock"sv;
+const std::string_view kVerdictSuffix = ".verdict"sv;
+const std::string_view kRunTimeSuffix = ".runtime"sv;
+const std::string_view kTempMarker = ".tmp"sv;
+const std::string_view kHotDir = "aot"sv;
+const std::string_view kIndexDir = "index"sv;
+const std::string_view kMigratedMarker = ".migrated"sv;
+
+// Entries used this recently are not evicted, so a container that just
+// released its reference does not force a recompile on its restart.
+const auto kEvictGracePeriod = std::chrono::minutes(1);
+
+cxx20::expected<std::time_t, int>
+modifyTime(const std::filesystem::path &Path) noexcept {
+  struct stat Stat;
+  if (::stat(Path.c_str(), &Stat) < 0) {
+    return cxx20::unexpected(errno);
+  }
+  return Stat.st_mtime;
+}
+
+std::string fileIdentity(const std::filesystem::path &Path) {
+  struct stat Stat;
+  if (::stat(Path.c_str(), &Stat) < 0) {
+    return {};
+  }
+  return fmt::format("{} {} {} {}"sv, Stat.st_size, Stat.st_ino,
+                     Stat.st_mtim.tv_sec, Stat.st_mtim.tv_nsec);
+}
+
+std::filesystem::path verdictPath(const std::filesystem::path &Path) {
+  auto VerdictPath = Path;
+  VerdictPath.concat(kVerdictSuffix);
+  return VerdictPath;
+}
+
+/// Verdict line recorded for the artifact at Path, empty if there is none.
+std::string readVerdict(const std::filesystem::path &Path) {
+  std::ifstream Stream(verdictPath(Path));
+  std::string Verdict;
+  std::getline(Stream, Verdict);
+  return Verdict;
+}
+
+/// Check that Path is the file its verdict was recorded for, under Key.
+bool matchVerdict(const std::filesystem::path &Path, std::string_view Key) {
+  const auto Identity = fileIdentity(Path);
+  if (Identity.empty()) {
+    return false;
+  }
+  const auto Verdict = readVerdict(Path);
+  if (Verdict.empty()) {
+    spdlog::info("{} has no verdict"sv, Path);
+    return false;
+  }
+  if (Verdict.size() != Key.size() + 1 + Identity.size() ||
+      Verdict.compare(0, Key.size(), Key) != 0 || Verdict[Key.size()] != ' ' ||
+      Verdict.compare(Key.size() + 1, Identity.size(), Identity) != 0) {
+    spdlog::info("{} does not match its verdict"sv, Path);
+    return false;
+  }
+  return true;
+}
+
+/// Record Key and the identity of TempPath as the verdict of Path, before
+/// TempPath is renamed to Path.
+cxx20::expected<void, int> writeVerdict(const std::filesystem::path &Path,
+                                        const std::filesystem::path &TempPath,
+                                        std::string_view Key) {
+  const auto Identity = fileIdentity(TempPath);
+  if (Identity.empty()) {
+    const int Err = errno;
+    spdlog::error("stat {} failed: {}"sv, TempPath, std::strerror(Err));
+    return cxx20::unexpected(Err);
+  }
+  const auto VerdictTemp = verdictPath(TempPath);
+  if (std::ofstream Stream(VerdictTemp); !Stream) {
+    spdlog::error("create {} failed"sv, VerdictTemp);
+    return cxx20::unexpected(EIO);
+  } else {
+    Stream << Key << ' ' << Identity << '\n';
+  }
+  if (std::error_code ErrCode;
+      std::filesystem::rename(VerdictTemp, verdictPath(Path), ErrCode),
+      ErrCode) {
+    spdlog::error("publish {} failed: {}"sv, verdictPath(Path),
+                  ErrCode.message());
+    std::filesystem::remove(VerdictTemp, ErrCode);
+    return cxx20::unexpected(ErrCode.value());
+  }
+  return {};
+}
+
+void removeHotCopy(const std::filesystem::path &HotPath) {
+  std::error_code ErrCode;
+  std::filesystem::remove(HotPath, ErrCode);
+  std::filesystem::remove(verdictPath(HotPath), ErrCode);
+}
+
+uint64_t fnv1a(std::string_view String) noexcept {
+  uint64_t Hash = UINT64_C(0xcbf29ce484222325);
+  for (const char C : String) {
+    Hash = (Hash ^ static_cast<uint8_t>(C)) * UINT64_C(0x100000001b3);
+  }
+  return Hash;
+}
+
+/// CPU the AOT compiler specializes code for. It targets the host CPU name
+/// and feature set as LLVM detects them, so the key covers every feature
+/// codegen may use, and an artifact compiled on one host is never loaded on
+/// a host that lacks one of them.
+std::string hostFeatures() {
+  llvm::StringMap<bool> FeatureMap;
+  std::vector<std::string> Features;
+  if (llvm::sys::getHostCPUFeatures(FeatureMap)) {
+    for (const auto &Feature : FeatureMap) {
+      Features.push_back((Feature.second ? "+"s : "-"s) +
+                         Feature.first().str());
+    }
+  }
+  std::sort(Features.begin(), Features.end());
+  std::string Joined;
+  for (const auto &Feature : Features) {
+    Joined += Feature;
+    Joined += ',';
+  }
+  // The full feature string does not fit in a file name
+  return fmt::format("{}-{:x}"sv, llvm::sys::getHostCPUName().str(),
+                     fnv1a(Joined));
+}
+
+/// Remove an entry and its lock file, with the entry lock held.
+void removeEntryFiles(const std::filesystem::path &Path) {
+  std::error_code ErrCode;
+  std::filesystem::remove(Path, ErrCode);
+  std::filesystem::remove(verdictPath(Path), ErrCode);
+  auto LockPath = Path;
+  LockPath.concat(kLockSuffix);
+  std::filesystem::remove(LockPath, ErrCode);
+  std::filesystem::remove(Snapshot::path(Path), ErrCode);
+  std::filesystem::remove_all(AOTCache::referenceDir(Path), ErrCode);
+}
+
+} // namespace
+
+std::string AOTCache::configKey(const WasmEdge::Configure &Conf) {
+  uint64_t Proposals = 0;
+  for (uint8_t I = 0; I < static_cast<uint8_t>(WasmEdge::Proposal::Max); ++I) {
+    if (Conf.hasProposal(static_cast<WasmEdge::Proposal>(I))) {
+      Proposals |= UINT64_C(1) << I;
+    }
+  }
+  static const std::string Features = hostFeatures();
+  // Interruptible code is slower, so it is kept apart from the plain code
+  return fmt::format("{}-{:x}-{}{}"sv, kVersionString, Proposals, Features,
+                     Conf.getCompilerConfigure().isInterruptible()
+                         ? "-interruptible"sv
+                         : ""sv);
+}
+
+WasmEdge::Expect<std::filesystem::path>
+AOTCache::getPath(WasmEdge::Span<const WasmEdge::Byte> Data,
+                  const WasmEdge::Configure &Conf) {
+  return WasmEdge::AOT::Cache::getPath(
+             Data, WasmEdge::AOT::Cache::StorageScope::Global, configKey(Conf))
+      .map([](std::filesystem::path Path) {
+        Path.replace_extension(std::filesystem::u8path(".so"sv));
+        return Path;
+      });
+}
+
+std::filesystem::path AOTCache::root() {
+  if (auto Res = WasmEdge::AOT::Cache::getPath(
+          {}, WasmEdge::AOT::Cache::StorageScope::Global)) {
+    return Res->parent_path();
+  }
+  return {};
+}
+
+AOTCache::Lock::~Lock() noexcept {
+  if (Fd >= 0) {
+    close(Fd);
+  }
+}
+
+cxx20::expected<AOTCache::Lock, int>
+AOTCache::lock(const std::filesystem::path &SoPath, bool Wait,
+               bool Shared) noexcept {
+  auto Path = SoPath;
+  Path.concat(kLockSuffix);
+  const int Operation = Shared ? LOCK_SH : LOCK_EX;
+  while (true) {
+    Lock Result(open(Path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+    if (Result.Fd < 0) {
+      const int Err = errno;
+      spdlog::error("open {} failed: {}"sv, Path, std::strerror(Err));
+      return cxx20::unexpected(Err);
+    }
+
+    // Try without blocking first, so only a lock that is taken gets logged
+    for (int Flags = LOCK_NB; flock(Result.Fd, Operation | Flags) < 0;) {
+      if (const int Err = errno; Err == EWOULDBLOCK && Flags == LOCK_NB) {
+        if (!Wait) {
+          return cxx20::unexpected(Err);
+        }
+        spdlog::info("wait cache lock"sv);
+        Flags = 0;
+      } else if (Err != EINTR) {
+        spdlog::error("lock {} failed: {}"sv, Path, std::strerror(Err));
+        return cxx20::unexpected(Err);
+      }
+    }
+
+    // Eviction unlinks the lock file while holding it; a lock taken on the
+    // unlinked file guards nothing, so retry on the current one
+    struct stat Held, Current;
+    if (fstat(Result.Fd, &Held) == 0 && ::stat(Path.c_str(), &Current) == 0 &&
+        Held.st_dev == Current.st_dev && Held.st_ino == Current.st_ino) {
+      return Result;
+    }
+  }
+}
+
+cxx20::expected<void, int>
+AOTCache::recordVerdict(const std::filesystem::path &SoPath,
+                        const std::filesystem::path &TempPath,
+                        const WasmEdge::Configure &Conf) noexcept {
+  // A hot tier copy would shadow the artifact that is about to be published
+  removeHotCopy(hotPath(SoPath));
+  return writeVerdict(SoPath, TempPath, configKey(Conf));
+}
+
+bool AOTCache::verify(const std::filesystem::path &SoPath,
+                      const WasmEdge::Configure &Conf) noexcept {
+  return matchVerdict(SoPath, configKey(Conf));
+}
+
+std::filesystem::path
+AOTCache::indexPath(const std::filesystem::path &WasmPath,
+                    const WasmEdge::Configure &Conf) {
+  struct stat Stat;
+  if (::stat(WasmPath.c_str(), &Stat) < 0) {
+    return {};
+  }
+  return root() / kIndexDir / configKey(Conf) /
+         fmt::format("stat-{:x}-{:x}-{:x}-{}.{}-{}.{}"sv, Stat.st_dev,
+                     Stat.st_ino, Stat.st_size, Stat.st_mtim.tv_sec,
+                     Stat.st_mtim.tv_nsec, Stat.st_ctim.tv_sec,
+                     Stat.st_ctim.tv_nsec);
+}
+
+std::optional<std::filesystem::path>
+AOTCache::lookup(const std::filesystem::path &WasmPath,
+                 const WasmEdge::Configure &Conf, Lock &Shared) noexcept {
+  const auto Path = indexPath(WasmPath, Conf);
+  if (Path.empty()) {
+    return std::nullopt;
+  }
+  std::error_code ErrCode;
+  auto SoPath = std::filesystem::read_symlink(Path, ErrCode);
+  if (ErrCode) {
+    return std::nullopt;
+  }
+  if (auto Res = lock(SoPath, true, true); Res && verify(SoPath, Conf)) {
+    Shared = std::move(*Res);
+    return SoPath;
+  }
+  return std::nullopt;
+}
+
+void AOTCache::index(const std::filesystem::path &WasmPath,
+                     const WasmEdge::Configure &Conf,
+                     const std::filesystem::path &SoPath) noexcept {
+  const auto Path = indexPath(WasmPath, Conf);
+  if (Path.empty()) {
+    return;
+  }
+  auto TempPath = Path;
+  TempPath.concat(fmt::format("{}{}"sv, kTempMarker, getpid()));
+  std::error_code ErrCode;
+  std::filesystem::create_directories(Path.parent_path(), ErrCode);
+  std::filesystem::create_symlink(SoPath, TempPath, ErrCode);
+  if (!ErrCode) {
+    std::filesystem::rename(TempPath, Path, ErrCode);
+  }
+  if (ErrCode) {
+    spdlog::error("index {} failed: {}"sv, Path, ErrCode.message());
+    std::filesystem::remove(TempPath, ErrCode);
+  }
+}
+
+void AOTCache::recordRun(const std::filesystem::path &SoPath,
+                         std::chrono::nanoseconds RunTime) noexcept {
+  auto Path = SoPath;
+  Path.concat(kRunTimeSuffix);
+  // The file holds one running total, so it stays a few bytes however often
+  // the module runs; replicas stopping together serialize on its lock
+  const int Fd = open(Path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (Fd < 0) {
+    spdlog::error("open {} failed: {}"sv, Path, std::strerror(errno));
+    return;
+  }
+  BOOST_SCOPE_EXIT_ALL(&) { close(Fd); };
+  while (flock(Fd, LOCK_EX) < 0) {
+    if (errno != EINTR) {
+      spdlog::error("lock {} failed: {}"sv, Path, std::strerror(errno));
+      return;
+    }
+  }
+
+  std::array<char, 64> Buffer;
+  const ssize_t Size = pread(Fd, Buffer.data(), Buffer.size() - 1, 0);
+  uint64_t Total = 0;
+  uint64_t Runs = 0;
+  if (Size > 0) {
+    Buffer[Size] = '\0';
+    std::sscanf(Buffer.data(), "%" SCNu64 " %" SCNu64, &Total, &Runs);
+  }
+  Total += static_cast<uint64_t>(std::max<int64_t>(RunTime.count(), 0));
+  ++Runs;
+  const auto Record = fmt::format("{} {}\n"sv, Total, Runs);
+  if (pwrite(Fd, Record.data(), Record.size(), 0) < 0 ||
+      ftruncate(Fd, static_cast<off_t>(Record.size())) < 0) {
+    spdlog::error("write {} failed: {}"sv, Path, std::strerror(errno));
+  }
+}
+
+std::chrono::nanoseconds
+AOTCache::runTime(const std::filesystem::path &SoPath) noexcept {
+  auto Path = SoPath;
+  Path.concat(kRunTimeSuffix);
+  std::ifstream Stream(Path);
+  uint64_t Total = 0;
+  Stream >> Total;
+  return std::chrono::nanoseconds(Total);
+}
+
+std::filesystem::path AOTCache::hotPath(const std::filesystem::path &SoPath) {
+  return std::filesystem::u8path(kStateDir) / kHotDir /
+         SoPath.lexically_relative(root());
+}
+
+std::filesystem::path AOTCache::locate(const std::filesystem::path &SoPath,
+                                       const WasmEdge::Configure &Conf) {
+  if (auto Path = hotPath(SoPath); matchVerdict(Path, configKey(Conf))) {
+    return Path;
+  }
+  return SoPath;
+}
+
+void AOTCache::migrate() noexcept {
+  const auto Root = root();
+  const auto Marker = Root / kMigratedMarker;
+  std::error_code ErrCode;
+  if (Root.empty() || std::filesystem::exists(Marker, ErrCode)) {
+    return;
+  }
+
+  // Older releases kept the artifacts of a container in a directory named
+  // after it. Directories of this release are named by their config key and
+  // hold verdicts once anything was published in them.
+  const auto Prefix = fmt::format("{}-"sv, kVersionString);
+  for (std::filesystem::directory_iterator Iter(Root, ErrCode), End;
+       !ErrCode && Iter != End; Iter.increment(ErrCode)) {
+    const auto &Dir = Iter->path();
+    const auto Name = Dir.filename().u8string();
+    std::error_code DirErr;
+    if (!Iter->is_directory(DirErr) || Name == kIndexDir ||
+        Name.compare(0, Prefix.size(), Prefix) == 0) {
+      continue;
+    }
+    bool Published = false;
+    for (std::filesystem::directory_iterator File(Dir, DirErr), FileEnd;
+         !DirErr && File != FileEnd; File.increment(DirErr)) {
+      if (File->path().extension().u8string() == kVerdictSuffix) {
+        Published = true;
+        break;
+      }
+    }
+    if (!Published) {
+      spdlog::info("remove cache of an older release: {}"sv, Dir);
+      std::filesystem::remove_all(Dir, DirErr);
+    }
+  }
+  std::ofstream(Marker).flush();
+}
+
+std::vector<AOTCache::Entry>
+AOTCache::list(const std::filesystem::path &ContainerDir, bool Prune) {
+  std::vector<Entry> Entries;
+  std::error_code ErrCode;
+  for (std::filesystem::recursive_directory_iterator Iter(root(), ErrCode),
+       End;
+       !ErrCode && Iter != End; Iter.increment(ErrCode)) {
+    const auto &Path = Iter->path();
+    if (Path.extension() != ".so"sv ||
+        Path.filename().u8string().find(kTempMarker) != std::string::npos ||
+        !Iter->is_regular_file(ErrCode)) {
+      continue;
+    }
+
+    Entry Entry;
+    Entry.Path = Path;
+    Entry.Size = Iter->file_size(ErrCode);
+    // Hot copies are checked against the config key of their artifact
+    if (const auto Verdict = readVerdict(Path); !Verdict.empty()) {
+      Entry.Hot = matchVerdict(hotPath(Path),
+                               std::string_view(Verdict).substr(
+                                   0, Verdict.find(' ')));
+    }
+
+    // The reference directory is touched by every acquire, so its mtime is
+    // the last use. Entries that were only precompiled use their own mtime.
+    const auto RefDir = referenceDir(Path);
+    if (auto Time = modifyTime(RefDir)) {
+      Entry.LastUse = *Time;
+      for (const auto &Ref :
+           std::filesystem::directory_iterator(RefDir, ErrCode)) {
+        if (std::filesystem::is_directory(ContainerDir / Ref.path().filename(),
+                                          ErrCode)) {
+          ++Entry.References;
+        } else if (Prune) {
+          spdlog::info("drop stale reference {}"sv, Ref.path());
+          std::filesystem::remove(Ref.path(), ErrCode);
+        }
+      }
+    } else {
+      Entry.LastUse = modifyTime(Path).value_or(0);
+    }
+    ErrCode.clear();
+    Entries.push_back(std::move(Entry));
+  }
+  return Entries;
+}
+
+cxx20::expected<void, int>
+AOTCache::collect(const std::filesystem::path &ContainerDir, uint64_t MaxSize,
+                  uint64_t HotSize) noexcept {
+  std::error_code ErrCode;
+
+  // Remove partial artifacts of compilers that died, unless one still runs,
+  // and the lock files of entries that were never published.
+  std::vector<std::filesystem::path> Orphans;
+  for (std::filesystem::recursive_directory_iterator Iter(root(), ErrCode),
+       End;
+       !ErrCode && Iter != End; Iter.increment(ErrCode)) {
+    if (Iter->path().filename() == kIndexDir) {
+      Iter.disable_recursion_pending();
+      continue;
+    }
+    const auto Name = Iter->path().filename().u8string();
+    if (Iter->path().extension() == kLockSuffix) {
+      if (auto SoPath = Iter->path().parent_path() /
+                        Name.substr(0, Name.size() - kLockSuffix.size());
+          !std::filesystem::exists(SoPath)) {
+        Orphans.push_back(std::move(SoPath));
+      }
+    } else if (const auto Pos = Name.find(kTempMarker);
+               Pos != std::string::npos) {
+      const auto SoPath =
+          Iter->path().parent_path() / (Name.substr(0, Pos) + ".so"s);
+      if (auto Lock = lock(SoPath, false)) {
+        spdlog::info("remove partial artifact {}"sv, Iter->path());
+        std::filesystem::remove(Iter->path(), ErrCode);
+      }
+    }
+  }
+  for (const auto &SoPath : Orphans) {
+    if (auto Lock = lock(SoPath, false);
+        Lock && !std::filesystem::exists(SoPath, ErrCode)) {
+      auto LockPath = SoPath;
+      LockPath.concat(kLockSuffix);
+      std::filesystem::remove(LockPath, ErrCode);
+    }
+  }
+
+  auto Entries = list(ContainerDir, true);
+  std::sort(Entries.begin(), Entries.end(),
+            [](const Entry &LHS, const Entry &RHS) {
+              return LHS.LastUse > RHS.LastUse;
+            });
+
+  const auto GraceLimit = std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now() - kEvictGracePeriod);
+  uint64_t Total = 0;
+  uint64_t HotTotal = 0;
+  for (const auto &Entry : Entries) {
+    const auto HotPath = hotPath(Entry.Path);
+    if (MaxSize != 0 && Total + Entry.Size > MaxSize &&
+        Entry.References == 0 && Entry.LastUse < GraceLimit) {
+      if (auto Lock = lock(Entry.Path, false)) {
+        spdlog::info("evict {}"sv, Entry.Path);
+        removeEntryFiles(Entry.Path);
+        removeHotCopy(HotPath);
+        continue;
+      }
+    }
+    Total += Entry.Size;
+
+    if (HotSize != 0 && HotTotal + Entry.Size <= HotSize) {
+      HotTotal += Entry.Size;
+      if (Entry.Hot) {
+        continue;
+      }
+      spdlog::info("promote {}"sv, Entry.Path);
+      auto TempPath = HotPath;
+      TempPath.concat(kTempMarker);
+      if (std::filesystem::create_directories(HotPath.parent_path(), ErrCode),
+          ErrCode) {
+        spdlog::error("create {} failed: {}"sv, HotPath.parent_path(),
+                      ErrCode.message());
+        return cxx20::unexpected(ErrCode.value());
+      }
+      // The copy gets a verdict of its own, so the file containers load
+      // from the hot tier is checked like the artifact itself
+      const auto Verdict = readVerdict(Entry.Path);
+      const auto Key = std::string_view(Verdict).substr(0, Verdict.find(' '));
+      if (std::filesystem::copy_file(
+              Entry.Path, TempPath,
+              std::filesystem::copy_options::overwrite_existing, ErrCode);
+          ErrCode || Verdict.empty() ||
+          !writeVerdict(HotPath, TempPath, Key) ||
+          (std::filesystem::rename(TempPath, HotPath, ErrCode), ErrCode)) {
+        spdlog::error("promote {} failed: {}"sv, Entry.Path,
+                      ErrCode.message());
+        std::filesystem::remove(TempPath, ErrCode);
+        removeHotCopy(HotPath);
+        HotTotal -= Entry.Size;
+      }
+    } else if (Entry.Hot) {
+      spdlog::info("demote {}"sv, Entry.Path);
+      removeHotCopy(HotPath);
+    }
+  }
+
+  // Drop index entries of evicted artifacts
+  for (std::filesystem::recursive_directory_iterator Iter(root() / kIndexDir,
+                                                          ErrCode),
+       End;
+       !ErrCode && Iter != End; Iter.increment(ErrCode)) {
+    if (Iter->is_symlink(ErrCode) &&
+        !std::filesystem::exists(Iter->path(), ErrCode)) {
+      std::filesystem::remove(Iter->path(), ErrCode);
+    }
+  }
+
+  spdlog::info("cache size {} bytes, hot tier {} bytes"sv, Total, HotTotal);
+  return {};
+}
+
+} // namespace RUNW
@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "aotcache.h"
+#include <common/log.h>
+#include <fstream>
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+const std::string_view kArtifactLink = "aot.so"sv;
+const std::string_view kReferenceSuffix = ".refs"sv;
+
+} // namespace
+
+std::filesystem::path
+AOTCache::referenceDir(const std::filesystem::path &SoPath) {
+  auto Path = SoPath;
+  Path.concat(kReferenceSuffix);
+  return Path;
+}
+
+cxx20::expected<void, int>
+AOTCache::acquire(const std::filesystem::path &SoPath,
+                  const std::filesystem::path &ContainerRoot) noexcept {
+  const auto RefDir = referenceDir(SoPath);
+  if (std::error_code ErrCode;
+      std::filesystem::create_directories(RefDir, ErrCode), ErrCode) {
+    spdlog::error("create {} failed: {}"sv, RefDir, ErrCode.message());
+    return cxx20::unexpected(ErrCode.value());
+  }
+
+  if (std::ofstream Stream(RefDir / ContainerRoot.filename()); !Stream) {
+    spdlog::error("create reference of {} failed"sv, SoPath);
+    return cxx20::unexpected(EIO);
+  }
+
+  const auto Link = ContainerRoot / kArtifactLink;
+  if (std::error_code ErrCode;
+      std::filesystem::create_symlink(SoPath, Link, ErrCode), ErrCode) {
+    spdlog::error("link {} failed: {}"sv, Link, ErrCode.message());
+    return cxx20::unexpected(ErrCode.value());
+  }
+  return {};
+}
+
+cxx20::expected<void, int>
+AOTCache::release(const std::filesystem::path &ContainerRoot) noexcept {
+  std::error_code ErrCode;
+  const auto SoPath =
+      std::filesystem::read_symlink(ContainerRoot / kArtifactLink, ErrCode);
+  if (ErrCode) {
+    // container never reached a compiled artifact
+    return {};
+  }
+
+  std::filesystem::remove(referenceDir(SoPath) / ContainerRoot.filename(),
+                          ErrCode);
+  if (ErrCode) {
+    spdlog::error("release reference of {} failed: {}"sv, SoPath,
+                  ErrCode.message());
+    return cxx20::unexpected(ErrCode.value());
+  }
+  return {};
+}
+
+} // namespace RUNW
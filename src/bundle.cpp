@@ -3,6 +3,7 @@
 #define ELPP_STL_LOGGING
 #include "bundle.h"
 #include "defines.h"
+#include <charconv>
 #include <common/log.h>
 #include <simdjson.h>
 
@@ -645,6 +646,29 @@ bool Bundle::load(const std::filesystem::path &Path,
                   }
                 }
                 break;
+              case 'c':
+                if (Key == "cpu"sv) {
+                  simdjson::dom::object Cpu;
+                  if (Element.get(Cpu)) {
+                    return false;
+                  }
+                  for (const auto &[Key, Element] : Cpu) {
+                    switch (Key[0]) {
+                    case 'c':
+                      if (Key == "cpus"sv) {
+                        std::string_view Cpus;
+                        if (Element.get(Cpus)) {
+                          return false;
+                        }
+                        ResourcesCpuCpus = Cpus;
+                      }
+                      break;
+                    default:
+                      break;
+                    }
+                  }
+                }
+                break;
               case 'd':
                 if (Key == "devices"sv) {
                 }
@@ -704,6 +728,18 @@ bool Bundle::load(const std::filesystem::path &Path,
         }
         for (const auto &[Key, Element] : Annotations) {
           switch (Key[0]) {
+            case 'i':
+              if (Key == "io.kubernetes.cri.sandbox-id"sv ||
+                  Key == "io.kubernetes.cri-o.SandboxID"sv) {
+                std::string_view Sandbox;
+                if (auto Error = Element.get(Sandbox)) {
+                  spdlog::error("load sandbox id failed: {}"sv,
+                                simdjson::error_message(Error));
+                  return false;
+                }
+                SandboxId = Sandbox;
+              }
+              break;
             case 'o':
               if (Key == "org.wasmedge.exec.allow_commands"sv) {
                 simdjson::dom::array Cmds;
@@ -722,6 +758,57 @@ bool Bundle::load(const std::filesystem::path &Path,
                   spdlog::info("Get cmd: {}"sv, CmdStr);
                   this->Cmds.emplace_back(CmdStr);
                 }
+              } else if (Key == "org.wasmedge.exec.tiered"sv) {
+                std::string_view Tiered;
+                if (auto Error = Element.get(Tiered)) {
+                  spdlog::error("load tiered failed: {}"sv,
+                                simdjson::error_message(Error));
+                  return false;
+                }
+                TieredExecution = Tiered == "true"sv;
+              } else if (Key == "org.wasmedge.aot.run_time"sv) {
+                std::string_view Record;
+                if (auto Error = Element.get(Record)) {
+                  spdlog::error("load run time failed: {}"sv,
+                                simdjson::error_message(Error));
+                  return false;
+                }
+                RecordRunTime = Record == "true"sv;
+              } else if (Key == "org.wasmedge.snapshot.init"sv) {
+                std::string_view Init;
+                if (auto Error = Element.get(Init)) {
+                  spdlog::error("load snapshot init failed: {}"sv,
+                                simdjson::error_message(Error));
+                  return false;
+                }
+                SnapshotInit = Init;
+              } else if (Key == "org.wasmedge.host"sv) {
+                std::string_view Host;
+                if (auto Error = Element.get(Host)) {
+                  spdlog::error("load host failed: {}"sv,
+                                simdjson::error_message(Error));
+                  return false;
+                }
+                HostName = Host;
+              } else if (Key == "org.wasmedge.output.buffer"sv ||
+                         Key == "org.wasmedge.output.flush_interval"sv) {
+                std::string_view Value;
+                if (auto Error = Element.get(Value)) {
+                  spdlog::error("load {} failed: {}"sv, Key,
+                                simdjson::error_message(Error));
+                  return false;
+                }
+                uint32_t &Field = Key == "org.wasmedge.output.buffer"sv
+                                      ? OutputBufferSize
+                                      : OutputFlushInterval;
+                if (auto Res = std::from_chars(Value.data(),
+                                               Value.data() + Value.size(),
+                                               Field);
+                    Res.ec != std::errc() ||
+                    Res.ptr != Value.data() + Value.size()) {
+                  spdlog::error("invalid {}: {}"sv, Key, Value);
+                  return false;
+                }
               }
               break;
             default:
@@ -7,7 +7,9 @@
 #include "state.h"
 #include <common/log.h>
 #include <fstream>
+#include <fcntl.h>
 #include <sys/vfs.h>
+#include <unistd.h>
 
 using namespace std::literals;
 
@@ -15,6 +17,8 @@ namespace RUNW {
 
 namespace {
 
+const std::string_view kCGroupRoot = "/sys/fs/cgroup"sv;
+
 class JobStatusChecker {
 public:
   cxx20::expected<void, int> setup(SDBus &Bus) noexcept {
@@ -111,17 +115,19 @@ cxx20::expected<std::string, int> readAll(std::filesystem::path Path) {
   return Content;
 }
 
-} // namespace
-
-const CGroup::Mode CGroup::CGroupMode = checkMode();
-
-cxx20::expected<void, int> CGroup::enter(std::string_view ContainerId,
-                                         const State &State) noexcept {
+cxx20::expected<void, int>
+startScope(const std::string &Scope, const std::string &Slice,
+           const char *Description, pid_t Pid, bool Delegate,
+           const CGroup::Resources *Limits) noexcept {
   SDBus Bus;
   if (auto Res = SDBus::defaultUser()) {
     Bus = std::move(*Res);
   } else if (auto Res = SDBus::defaultSystem()) {
     Bus = std::move(*Res);
+  } else if (Limits) {
+    // Nodes without systemd compile without limits, which is no failure
+    spdlog::info("cannot open sd-bus: {}"sv, strerror(Res.error()));
+    return Res.map([](const auto &) {});
   } else {
     spdlog::error("cannot open sd-bus: {}"sv, strerror(Res.error()));
     return Res.map([](const auto &) {});
@@ -144,28 +150,6 @@ cxx20::expected<void, int> CGroup::enter(std::string_view ContainerId,
     return Res.map([](const auto &) {});
   }
 
-  auto CgroupsPath = State.bundle().linuxCgroupsPath();
-  std::string Scope, Slice;
-  if (CgroupsPath.empty()) {
-    Scope = "runw-"sv;
-    Scope += ContainerId;
-    Scope += ".scope"sv;
-  } else {
-    const auto FirstColon = CgroupsPath.find(':');
-    if (FirstColon == std::string_view::npos) {
-      Scope = CgroupsPath;
-      Scope += ".scope"sv;
-    } else {
-      Scope = CgroupsPath.substr(FirstColon + 1);
-      const auto SecondColon = Scope.find(':', FirstColon + 1);
-      if (SecondColon != std::string_view::npos) {
-        Scope[SecondColon] = '-';
-      }
-      Scope += ".scope"sv;
-    }
-    Slice = CgroupsPath.substr(0, FirstColon);
-  }
-
   if (auto Res = Msg.append("ss", Scope.c_str(), "fail"); !Res) {
     spdlog::error("sd-bus message append scope: {}"sv, strerror(Res.error()));
     return Res;
@@ -185,20 +169,19 @@ cxx20::expected<void, int> CGroup::enter(std::string_view ContainerId,
 
   // TODO: systemd annotations "org.systemd.property."
 
-  if (auto Res = Msg.append("(sv)", "Description", "s", "runw container");
-      !Res) {
+  if (auto Res = Msg.append("(sv)", "Description", "s", Description); !Res) {
     spdlog::error("sd-bus message append Description: {}"sv,
                   strerror(Res.error()));
     return Res;
   }
 
-  if (auto Res = Msg.append("(sv)", "PIDs", "au", 1, State.getPid()); !Res) {
+  if (auto Res = Msg.append("(sv)", "PIDs", "au", 1, Pid); !Res) {
     spdlog::error("sd-bus message append Description: {}"sv,
                   strerror(Res.error()));
     return Res;
   }
 
-  for (auto [Name, Value] : {std::pair{"Delegate", true}}) {
+  for (auto [Name, Value] : {std::pair{"Delegate", Delegate}}) {
     if (!Value) {
       continue;
     }
@@ -209,6 +192,30 @@ cxx20::expected<void, int> CGroup::enter(std::string_view ContainerId,
     }
   }
 
+  if (Limits) {
+    // Do not keep the scope of an OOM-killed compile around
+    if (auto Res =
+            Msg.append("(sv)", "CollectMode", "s", "inactive-or-failed");
+        !Res) {
+      spdlog::error("sd-bus message append CollectMode: {}"sv,
+                    strerror(Res.error()));
+      return Res;
+    }
+    for (auto [Name, Value] :
+         {std::pair{"CPUWeight", Limits->CPUWeight},
+          std::pair{"CPUQuotaPerSecUSec", Limits->CPUQuotaPercent * 10000},
+          std::pair{"MemoryMax", Limits->MemoryMax}}) {
+      if (Value == 0) {
+        continue;
+      }
+      if (auto Res = Msg.append("(sv)", Name, "t", Value); !Res) {
+        spdlog::error("sd-bus message append {}:{}"sv, Name,
+                      strerror(Res.error()));
+        return Res;
+      }
+    }
+  }
+
   if (auto Res = Msg.closeContainer(); !Res) {
     spdlog::error("sd-bus close container: {}"sv, strerror(Res.error()));
     return Res;
@@ -235,6 +242,110 @@ cxx20::expected<void, int> CGroup::enter(std::string_view ContainerId,
   return Checker.check(Bus, Object, "creating");
 }
 
+std::pair<std::string, std::string> scopeOf(std::string_view ContainerId,
+                                            const State &State) {
+  auto CgroupsPath = State.bundle().linuxCgroupsPath();
+  std::string Scope, Slice;
+  if (CgroupsPath.empty()) {
+    Scope = "runw-"sv;
+    Scope += ContainerId;
+    Scope += ".scope"sv;
+  } else {
+    const auto FirstColon = CgroupsPath.find(':');
+    if (FirstColon == std::string_view::npos) {
+      Scope = CgroupsPath;
+      Scope += ".scope"sv;
+    } else {
+      Scope = CgroupsPath.substr(FirstColon + 1);
+      const auto SecondColon = Scope.find(':', FirstColon + 1);
+      if (SecondColon != std::string_view::npos) {
+        Scope[SecondColon] = '-';
+      }
+      Scope += ".scope"sv;
+    }
+    Slice = CgroupsPath.substr(0, FirstColon);
+  }
+  return {std::move(Scope), std::move(Slice)};
+}
+
+} // namespace
+
+const CGroup::Mode CGroup::CGroupMode = checkMode();
+
+cxx20::expected<void, int> CGroup::enter(std::string_view ContainerId,
+                                         const State &State) noexcept {
+  const auto [Scope, Slice] = scopeOf(ContainerId, State);
+  return startScope(Scope, Slice, "runw container", State.getPid(), true,
+                    nullptr);
+}
+
+cxx20::expected<void, int> CGroup::prepare(std::string_view ContainerId,
+                                           const State &State,
+                                           pid_t Pid) noexcept {
+  const auto [Scope, Slice] = scopeOf(ContainerId, State);
+  return startScope(Scope, Slice, "runw container", Pid, true, nullptr);
+}
+
+cxx20::expected<int, int> CGroup::target(pid_t Pid) noexcept {
+  if (CGroupMode != Mode::Unified) {
+    return cxx20::unexpected(ENOTSUP);
+  }
+
+  std::string Content;
+  if (auto Res = readAll(std::filesystem::u8path("/proc"sv) /
+                         std::filesystem::u8path(std::to_string(Pid)) /
+                         std::filesystem::u8path("cgroup"sv))) {
+    Content = std::move(*Res);
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  auto From = Content.find("0::"sv);
+  if (From == std::string::npos) {
+    spdlog::error("cannot find cgroup2 of process {}"sv, Pid);
+    return cxx20::unexpected(EINVAL);
+  }
+  From += 3;
+  auto To = Content.find('\n', From);
+  if (To == std::string::npos) {
+    spdlog::error("cannot parse cgroup of process {}"sv, Pid);
+    return cxx20::unexpected(EINVAL);
+  }
+  const auto Dir =
+      std::filesystem::u8path(kCGroupRoot) /
+      std::filesystem::u8path(Content.substr(From, To - From)).relative_path();
+  const int Fd = open(Dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (Fd < 0) {
+    const int Err = errno;
+    spdlog::error("open {} failed: {}"sv, Dir, strerror(Err));
+    return cxx20::unexpected(Err);
+  }
+  return Fd;
+}
+
+cxx20::expected<void, int> CGroup::join(int Fd, pid_t Pid) noexcept {
+  const int Procs = openat(Fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+  if (Procs < 0) {
+    const int Err = errno;
+    spdlog::error("open cgroup.procs failed: {}"sv, strerror(Err));
+    return cxx20::unexpected(Err);
+  }
+  const auto Value = std::to_string(Pid);
+  const ssize_t Size = write(Procs, Value.data(), Value.size());
+  const int Err = errno;
+  close(Procs);
+  if (Size < 0) {
+    spdlog::error("move {} into its cgroup failed: {}"sv, Pid, strerror(Err));
+    return cxx20::unexpected(Err);
+  }
+  return {};
+}
+
+cxx20::expected<void, int>
+CGroup::enterCompile(pid_t Pid, const Resources &Limits) noexcept {
+  const auto Scope = "runw-aot-"s + std::to_string(Pid) + ".scope"s;
+  return startScope(Scope, {}, "runw AOT compile", Pid, false, &Limits);
+}
+
 cxx20::expected<void, int> CGroup::finalize(const State &State) {
   if (CGroupMode == Mode::Unknown) {
     spdlog::error("unknown cgroup mode"sv);
@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "compileserver.h"
+#include "config.h"
+#include "unixsocket.h"
+#include <boost/scope_exit.hpp>
+#include <common/log.h>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+const std::string_view kSocketName = "compile.sock"sv;
+
+struct Job {
+  std::filesystem::path WasmPath;
+  std::vector<int> Waiters;
+};
+
+void reply(int Fd, bool Success) noexcept {
+  const char Status = Success ? '0' : '1';
+  send(Fd, &Status, sizeof(Status), MSG_NOSIGNAL);
+  close(Fd);
+}
+
+} // namespace
+
+std::filesystem::path CompileServer::socketPath() {
+  return std::filesystem::u8path(kStateDir) / kSocketName;
+}
+
+cxx20::expected<void, int> CompileServer::serve(uint32_t Jobs,
+                                                CompileFunc Compile) noexcept {
+  const auto Path = socketPath();
+  sigset_t Mask;
+  sigemptyset(&Mask);
+  sigaddset(&Mask, SIGCHLD);
+  sigaddset(&Mask, SIGINT);
+  sigaddset(&Mask, SIGTERM);
+  if (sigprocmask(SIG_BLOCK, &Mask, nullptr) < 0) {
+    spdlog::error("sigprocmask failed: {}"sv, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+  const int SignalFd = signalfd(-1, &Mask, SFD_CLOEXEC);
+  if (SignalFd < 0) {
+    spdlog::error("signalfd failed: {}"sv, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+  BOOST_SCOPE_EXIT_ALL(&SignalFd) { close(SignalFd); };
+
+  if (std::error_code ErrCode;
+      std::filesystem::create_directories(Path.parent_path(), ErrCode),
+      ErrCode) {
+    spdlog::error("create {} failed: {}"sv, Path.parent_path(),
+                  ErrCode.message());
+    return cxx20::unexpected(ErrCode.value());
+  }
+
+  int ListenFd;
+  if (auto Res = UnixSocket::listen(Path, SOCK_STREAM)) {
+    ListenFd = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&ListenFd, &Path) {
+    close(ListenFd);
+    unlink(Path.c_str());
+  };
+  spdlog::info("compile server listening on {} with {} jobs"sv, Path, Jobs);
+
+  // Pending requests keyed by client, jobs keyed by artifact path
+  std::map<int, std::string> Clients;
+  std::map<std::string, Job> JobMap;
+  std::deque<std::string> Queue;
+  std::map<pid_t, std::string> Running;
+
+  auto &&Dispatch = [&]() {
+    while (Running.size() < Jobs && !Queue.empty()) {
+      auto Key = std::move(Queue.front());
+      Queue.pop_front();
+      auto &Job = JobMap[Key];
+      const pid_t Pid = fork();
+      if (Pid < 0) {
+        spdlog::error("fork failed: {}"sv, std::strerror(errno));
+        for (const int Fd : Job.Waiters) {
+          reply(Fd, false);
+        }
+        JobMap.erase(Key);
+        continue;
+      }
+      if (Pid == 0) {
+        sigprocmask(SIG_UNBLOCK, &Mask, nullptr);
+        close(ListenFd);
+        close(SignalFd);
+        for (const auto &[Fd, Buffer] : Clients) {
+          close(Fd);
+        }
+        for (const auto &[Other, Pending] : JobMap) {
+          for (const int Fd : Pending.Waiters) {
+            close(Fd);
+          }
+        }
+        // Yield to running workloads
+        setpriority(PRIO_PROCESS, 0, 19);
+        sched_param Param = {};
+        sched_setscheduler(0, SCHED_BATCH, &Param);
+        exit(Compile(Job.WasmPath) ? EXIT_SUCCESS : EXIT_FAILURE);
+      }
+      spdlog::info("compiling {}"sv, Job.WasmPath);
+      Running.emplace(Pid, std::move(Key));
+    }
+  };
+
+  while (true) {
+    std::vector<pollfd> Fds;
+    Fds.push_back({SignalFd, POLLIN, 0});
+    Fds.push_back({ListenFd, POLLIN, 0});
+    for (const auto &[Fd, Buffer] : Clients) {
+      Fds.push_back({Fd, POLLIN, 0});
+    }
+    if (poll(Fds.data(), Fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      spdlog::error("poll failed: {}"sv, std::strerror(errno));
+      return cxx20::unexpected(errno);
+    }
+
+    if (Fds[0].revents & POLLIN) {
+      signalfd_siginfo Info;
+      if (read(SignalFd, &Info, sizeof(Info)) == sizeof(Info) &&
+          Info.ssi_signo != SIGCHLD) {
+        spdlog::info("compile server stopped"sv);
+        return {};
+      }
+      int Status;
+      pid_t Pid;
+      while ((Pid = waitpid(-1, &Status, WNOHANG)) > 0) {
+        auto Iter = Running.find(Pid);
+        if (Iter == Running.end()) {
+          continue;
+        }
+        const bool Success =
+            WIFEXITED(Status) && WEXITSTATUS(Status) == EXIT_SUCCESS;
+        spdlog::info("compiled {}: {}"sv, Iter->second,
+                     Success ? "done"sv : "failed"sv);
+        if (auto JobIter = JobMap.find(Iter->second);
+            JobIter != JobMap.end()) {
+          for (const int Fd : JobIter->second.Waiters) {
+            reply(Fd, Success);
+          }
+          JobMap.erase(JobIter);
+        }
+        Running.erase(Iter);
+      }
+    }
+
+    if (Fds[1].revents & POLLIN) {
+      // Compiles run as root on any path they are sent
+      if (const int Fd = accept4(ListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+          Fd >= 0 && UnixSocket::trustedPeer(Fd)) {
+        Clients.emplace(Fd, std::string());
+      } else if (Fd >= 0) {
+        close(Fd);
+      }
+    }
+
+    for (size_t I = 2; I < Fds.size(); ++I) {
+      if (Fds[I].revents == 0) {
+        continue;
+      }
+      const int Fd = Fds[I].fd;
+      auto &Buffer = Clients[Fd];
+      char Data[4096];
+      const auto Size = read(Fd, Data, sizeof(Data));
+      if (Size <= 0) {
+        close(Fd);
+        Clients.erase(Fd);
+        continue;
+      }
+      Buffer.append(Data, Size);
+
+      // Request: artifact path and wasm path, each terminated by '\0'
+      const auto First = Buffer.find('\0');
+      const auto Second = First == std::string::npos
+                              ? std::string::npos
+                              : Buffer.find('\0', First + 1);
+      if (Second == std::string::npos) {
+        continue;
+      }
+      auto Key = Buffer.substr(0, First);
+      auto WasmPath = std::filesystem::u8path(
+          Buffer.substr(First + 1, Second - First - 1));
+      Clients.erase(Fd);
+
+      auto [Iter, Inserted] = JobMap.try_emplace(Key);
+      if (Inserted) {
+        Iter->second.WasmPath = std::move(WasmPath);
+        Queue.push_back(std::move(Key));
+      } else {
+        spdlog::info("merge request for {}"sv, Key);
+      }
+      Iter->second.Waiters.push_back(Fd);
+    }
+
+    Dispatch();
+  }
+}
+
+cxx20::expected<void, int>
+CompileServer::request(const std::filesystem::path &SoPath,
+                       const std::filesystem::path &WasmPath,
+                       bool Wait) noexcept {
+  int Fd;
+  if (auto Res = UnixSocket::connect(socketPath(), SOCK_STREAM)) {
+    Fd = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&Fd) { close(Fd); };
+
+  std::string Message = SoPath.native();
+  Message += '\0';
+  Message += WasmPath.native();
+  Message += '\0';
+  for (std::string_view Rest = Message; !Rest.empty();) {
+    const auto Size = send(Fd, Rest.data(), Rest.size(), MSG_NOSIGNAL);
+    if (Size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      spdlog::error("send compile request failed: {}"sv, std::strerror(errno));
+      return cxx20::unexpected(errno);
+    }
+    Rest.remove_prefix(Size);
+  }
+  if (!Wait) {
+    return {};
+  }
+
+  spdlog::info("wait compile server"sv);
+  char Status;
+  ssize_t Size;
+  do {
+    Size = read(Fd, &Status, sizeof(Status));
+  } while (Size < 0 && errno == EINTR);
+  if (Size != sizeof(Status) || Status != '0') {
+    spdlog::error("compile server failed to compile {}"sv, WasmPath);
+    return cxx20::unexpected(EIO);
+  }
+  return {};
+}
+
+} // namespace RUNW
@@ -0,0 +1,285 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "daemon.h"
+#include "config.h"
+#include "unixsocket.h"
+#include <array>
+#include <boost/scope_exit.hpp>
+#include <common/log.h>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+const std::string_view kSocketName = "daemon.sock"sv;
+
+// Stdin, stdout and stderr of the client
+constexpr const size_t kFdCount = 3;
+constexpr const size_t kMaxRequestSize = 65536;
+
+/// Process attributes of the client the worker takes on, at the start of a
+/// request.
+struct Context {
+  uint32_t Umask;
+  /// Strings of the command line, which the environment follows
+  uint32_t ArgCount;
+  std::array<rlimit, RLIM_NLIMITS> Limits;
+};
+
+void reapChildren(int) noexcept {
+  const int Err = errno;
+  while (waitpid(-1, nullptr, WNOHANG) > 0) {
+  }
+  errno = Err;
+}
+
+/// Receive a request: the context, then the working directory, the
+/// arguments and the environment, each terminated by '\0', and the stdio fds
+/// of the client. Fds is filled even when the request is malformed, so the
+/// caller can close them.
+bool receiveRequest(int Fd, std::vector<char> &Buffer, Context &Context,
+                    std::vector<const char *> &Fields,
+                    std::array<int, kFdCount> &Fds) noexcept {
+  Fds.fill(-1);
+  Buffer.resize(kMaxRequestSize);
+  alignas(cmsghdr) char Control[CMSG_SPACE(sizeof(int) * kFdCount)];
+  iovec Iov = {Buffer.data(), Buffer.size()};
+  msghdr Msg = {};
+  Msg.msg_iov = &Iov;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+
+  ssize_t Size;
+  do {
+    Size = recvmsg(Fd, &Msg, MSG_CMSG_CLOEXEC);
+  } while (Size < 0 && errno == EINTR);
+  if (Size <= 0) {
+    return false;
+  }
+  for (cmsghdr *Cmsg = CMSG_FIRSTHDR(&Msg); Cmsg != nullptr;
+       Cmsg = CMSG_NXTHDR(&Msg, Cmsg)) {
+    if (Cmsg->cmsg_level == SOL_SOCKET && Cmsg->cmsg_type == SCM_RIGHTS &&
+        Cmsg->cmsg_len == CMSG_LEN(sizeof(int) * kFdCount)) {
+      std::memcpy(Fds.data(), CMSG_DATA(Cmsg), sizeof(int) * kFdCount);
+    }
+  }
+  if ((Msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || Fds.back() < 0) {
+    return false;
+  }
+  if (static_cast<size_t>(Size) <= sizeof(Context) ||
+      Buffer[Size - 1] != '\0') {
+    return false;
+  }
+  std::memcpy(&Context, Buffer.data(), sizeof(Context));
+
+  Fields.clear();
+  for (ssize_t Begin = sizeof(Context); Begin < Size;) {
+    Fields.push_back(Buffer.data() + Begin);
+    Begin += std::strlen(Buffer.data() + Begin) + 1;
+  }
+  // The working directory and at least the program name
+  return Context.ArgCount >= 1 && Fields.size() >= Context.ArgCount + 1;
+}
+
+} // namespace
+
+std::filesystem::path Daemon::socketPath() {
+  return std::filesystem::u8path(kStateDir) / kSocketName;
+}
+
+cxx20::expected<void, int> Daemon::serve(RunFunc Run) noexcept {
+  const auto Path = socketPath();
+  struct sigaction Action = {};
+  Action.sa_handler = reapChildren;
+  Action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigemptyset(&Action.sa_mask);
+  if (sigaction(SIGCHLD, &Action, nullptr) < 0) {
+    spdlog::error("sigaction failed: {}"sv, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+
+  if (std::error_code ErrCode;
+      std::filesystem::create_directories(Path.parent_path(), ErrCode),
+      ErrCode) {
+    spdlog::error("create {} failed: {}"sv, Path.parent_path(),
+                  ErrCode.message());
+    return cxx20::unexpected(ErrCode.value());
+  }
+
+  int ListenFd;
+  if (auto Res = UnixSocket::listen(Path, SOCK_SEQPACKET)) {
+    ListenFd = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&ListenFd, &Path) {
+    close(ListenFd);
+    unlink(Path.c_str());
+  };
+  spdlog::info("daemon listening on {}"sv, Path);
+
+  std::vector<char> Buffer;
+  Context Context;
+  std::vector<const char *> Fields;
+  while (true) {
+    const int Fd = accept4(ListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (Fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      spdlog::error("accept failed: {}"sv, std::strerror(errno));
+      return cxx20::unexpected(errno);
+    }
+    if (!UnixSocket::trustedPeer(Fd)) {
+      close(Fd);
+      continue;
+    }
+
+    std::array<int, kFdCount> Fds;
+    const bool Received = receiveRequest(Fd, Buffer, Context, Fields, Fds);
+    BOOST_SCOPE_EXIT_ALL(&Fd, &Fds) {
+      for (const int ReceivedFd : Fds) {
+        if (ReceivedFd >= 0) {
+          close(ReceivedFd);
+        }
+      }
+      close(Fd);
+    };
+    if (!Received) {
+      spdlog::error("malformed daemon request"sv);
+      continue;
+    }
+
+    const pid_t Pid = fork();
+    if (Pid < 0) {
+      spdlog::error("fork failed: {}"sv, std::strerror(errno));
+      continue;
+    }
+    if (Pid == 0) {
+      signal(SIGCHLD, SIG_DFL);
+      close(ListenFd);
+      for (int StdFd = 0; StdFd < 3; ++StdFd) {
+        if (Fds[StdFd] != StdFd) {
+          dup2(Fds[StdFd], StdFd);
+          close(Fds[StdFd]);
+        }
+      }
+      if (chdir(Fields[0]) < 0) {
+        spdlog::error("chdir {} failed: {}"sv, Fields[0],
+                      std::strerror(errno));
+        _Exit(EXIT_FAILURE);
+      }
+      umask(static_cast<mode_t>(Context.Umask));
+      for (int Resource = 0; Resource < RLIM_NLIMITS; ++Resource) {
+        if (setrlimit(Resource, &Context.Limits[Resource]) < 0) {
+          spdlog::info("setrlimit {} failed: {}"sv, Resource,
+                       std::strerror(errno));
+        }
+      }
+      clearenv();
+      for (auto Iter = Fields.begin() + 1 + Context.ArgCount;
+           Iter != Fields.end(); ++Iter) {
+        putenv(const_cast<char *>(*Iter));
+      }
+      std::vector<const char *> Argv(Fields.begin() + 1,
+                                     Fields.begin() + 1 + Context.ArgCount);
+      const pid_t Worker = getpid();
+      const int ExitCode = Run(static_cast<int>(Argv.size()), Argv.data());
+      // Processes forked by the command, like the container process of a
+      // create, return here as well
+      if (getpid() == Worker) {
+        send(Fd, &ExitCode, sizeof(ExitCode), MSG_NOSIGNAL);
+      }
+      exit(ExitCode);
+    }
+    spdlog::info("forwarded {} as {}"sv, Fields[1], Pid);
+  }
+}
+
+cxx20::expected<int, int> Daemon::forward(int Argc,
+                                          const char *Argv[]) noexcept {
+  int Fd;
+  if (auto Res = UnixSocket::connect(socketPath(), SOCK_SEQPACKET)) {
+    Fd = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&Fd) { close(Fd); };
+
+  Context Context = {};
+  Context.Umask = umask(0);
+  umask(static_cast<mode_t>(Context.Umask));
+  Context.ArgCount = static_cast<uint32_t>(Argc);
+  for (int Resource = 0; Resource < RLIM_NLIMITS; ++Resource) {
+    getrlimit(Resource, &Context.Limits[Resource]);
+  }
+
+  std::string Message(reinterpret_cast<const char *>(&Context),
+                      sizeof(Context));
+  std::error_code ErrCode;
+  Message += std::filesystem::current_path(ErrCode).u8string();
+  Message += '\0';
+  for (int I = 0; I < Argc; ++I) {
+    Message += Argv[I];
+    Message += '\0';
+  }
+  for (char **Env = environ; *Env != nullptr; ++Env) {
+    Message += *Env;
+    Message += '\0';
+  }
+  if (ErrCode || Message.size() > kMaxRequestSize) {
+    return cxx20::unexpected(EINVAL);
+  }
+
+  const std::array<int, kFdCount> Fds = {STDIN_FILENO, STDOUT_FILENO,
+                                         STDERR_FILENO};
+  alignas(cmsghdr) char Control[CMSG_SPACE(sizeof(int) * kFdCount)] = {};
+  iovec Iov = {Message.data(), Message.size()};
+  msghdr Msg = {};
+  Msg.msg_iov = &Iov;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+  cmsghdr *Cmsg = CMSG_FIRSTHDR(&Msg);
+  Cmsg->cmsg_level = SOL_SOCKET;
+  Cmsg->cmsg_type = SCM_RIGHTS;
+  Cmsg->cmsg_len = CMSG_LEN(sizeof(int) * kFdCount);
+  std::memcpy(CMSG_DATA(Cmsg), Fds.data(), sizeof(int) * kFdCount);
+
+  ssize_t Size;
+  do {
+    Size = sendmsg(Fd, &Msg, MSG_NOSIGNAL);
+  } while (Size < 0 && errno == EINTR);
+  if (Size < 0) {
+    spdlog::error("send daemon request failed: {}"sv, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+
+  // From here on the command may have run, so it is not retried locally
+  int ExitCode;
+  do {
+    Size = read(Fd, &ExitCode, sizeof(ExitCode));
+  } while (Size < 0 && errno == EINTR);
+  if (Size != sizeof(ExitCode)) {
+    spdlog::error("daemon worker exited without an exit code"sv);
+    return EXIT_FAILURE;
+  }
+  return ExitCode;
+}
+
+} // namespace RUNW
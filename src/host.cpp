@@ -0,0 +1,456 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "host.h"
+#include "config.h"
+#include "unixsocket.h"
+#include <atomic>
+#include <boost/scope_exit.hpp>
+#include <charconv>
+#include <common/log.h>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+const std::string_view kSocketDir = "hosts"sv;
+const std::string_view kSocketSuffix = ".sock"sv;
+/// Link from the container to the socket of its host
+const std::string_view kLinkName = "host.sock"sv;
+
+constexpr const size_t kMaxRequestSize = 16384;
+
+enum Verb : char {
+  kCreate = 'c',
+  kKill = 'k',
+  kWait = 'w',
+};
+
+struct Reply {
+  int Error;
+  int ExitCode;
+};
+
+struct Instance {
+  Host::Request Req;
+  pthread_t Thread{};
+  bool Started = false;
+  bool Done = false;
+  /// Instance returned by Prepare, while Run may still be stopped
+  std::shared_ptr<void> Prepared;
+  /// First signal that ended the instance
+  std::atomic<int> Signal{0};
+  /// Connections of waits, answered when the instance is done
+  std::vector<int> Waiters;
+};
+
+std::mutex Mutex;
+std::map<std::string, std::shared_ptr<Instance>, std::less<>> Instances;
+
+/// Signal of the instance the thread runs, for stopping()
+thread_local const std::atomic<int> *CurrentSignal = nullptr;
+
+/// Installed without SA_RESTART, so that the blocking call an instance thread
+/// is in fails with EINTR and Run gets to see it was stopped.
+void interrupt(int) noexcept {}
+
+int interruptSignal() noexcept { return SIGRTMIN; }
+
+/// Signals a process ignores by default do not end an instance either
+bool terminates(int Signal) noexcept {
+  return Signal != 0 && Signal != SIGCHLD && Signal != SIGCONT &&
+         Signal != SIGURG && Signal != SIGWINCH;
+}
+
+/// Send a message, with PassFd attached when it is valid.
+bool sendMessage(int Fd, const std::string &Message, int PassFd) noexcept {
+  alignas(cmsghdr) char Control[CMSG_SPACE(sizeof(int))] = {};
+  iovec Iov = {const_cast<char *>(Message.data()), Message.size()};
+  msghdr Msg = {};
+  Msg.msg_iov = &Iov;
+  Msg.msg_iovlen = 1;
+  if (PassFd >= 0) {
+    Msg.msg_control = Control;
+    Msg.msg_controllen = sizeof(Control);
+    cmsghdr *Cmsg = CMSG_FIRSTHDR(&Msg);
+    Cmsg->cmsg_level = SOL_SOCKET;
+    Cmsg->cmsg_type = SCM_RIGHTS;
+    Cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(Cmsg), &PassFd, sizeof(int));
+  }
+
+  ssize_t Size;
+  do {
+    Size = sendmsg(Fd, &Msg, MSG_NOSIGNAL);
+  } while (Size < 0 && errno == EINTR);
+  return Size == static_cast<ssize_t>(Message.size());
+}
+
+void sendReply(int Fd, int Error, int ExitCode) noexcept {
+  const Reply R = {Error, ExitCode};
+  send(Fd, &R, sizeof(R), MSG_NOSIGNAL);
+}
+
+cxx20::expected<Reply, int> receiveReply(int Fd) noexcept {
+  Reply R;
+  ssize_t Size;
+  do {
+    Size = read(Fd, &R, sizeof(R));
+  } while (Size < 0 && errno == EINTR);
+  if (Size != sizeof(R)) {
+    return cxx20::unexpected(EPIPE);
+  }
+  return R;
+}
+
+/// Split the fields after the verb, each terminated by '\0'.
+std::vector<std::string_view> splitFields(std::string_view Rest) {
+  std::vector<std::string_view> Fields;
+  while (!Rest.empty()) {
+    const auto End = Rest.find('\0');
+    if (End == std::string_view::npos) {
+      return {};
+    }
+    Fields.push_back(Rest.substr(0, End));
+    Rest.remove_prefix(End + 1);
+  }
+  return Fields;
+}
+
+/// Ask the host of a container, found through its link, about it.
+cxx20::expected<Reply, int> ask(const std::filesystem::path &ContainerRoot,
+                                Verb V, std::string_view ContainerId,
+                                std::string_view Argument) noexcept {
+  const auto Link = ContainerRoot / kLinkName;
+  if (std::error_code ErrCode; !std::filesystem::is_symlink(Link, ErrCode)) {
+    return cxx20::unexpected(ENOENT);
+  }
+
+  int Fd;
+  if (auto Res = UnixSocket::connect(Link, SOCK_SEQPACKET)) {
+    Fd = *Res;
+  } else if (Res.error() == ECONNREFUSED || Res.error() == ENOENT) {
+    // The host is gone, and its instances with it
+    return cxx20::unexpected(ESRCH);
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&Fd) { close(Fd); };
+
+  std::string Message(1, V);
+  Message += ContainerId;
+  Message += '\0';
+  if (!Argument.empty()) {
+    Message += Argument;
+    Message += '\0';
+  }
+  if (!sendMessage(Fd, Message, -1)) {
+    return cxx20::unexpected(errno);
+  }
+  return receiveReply(Fd);
+}
+
+void runInstance(std::shared_ptr<Instance> Inst, int Fd,
+                 const std::filesystem::path &SocketPath,
+                 const Host::PrepareFunc &Prepare, const Host::RunFunc &Run,
+                 const Host::KillFunc &Kill) {
+  const auto &Req = Inst->Req;
+  CurrentSignal = &Inst->Signal;
+  auto Prepared = Prepare(Req);
+  bool Ready = Prepared != nullptr;
+  if (Ready) {
+    if (std::error_code ErrCode; std::filesystem::create_symlink(
+            SocketPath, Req.ContainerRoot / kLinkName, ErrCode),
+        ErrCode) {
+      spdlog::error("link {} to host failed: {}"sv, Req.ContainerId,
+                    ErrCode.message());
+      Ready = false;
+    }
+  }
+  if (Ready) {
+    std::lock_guard Lock(Mutex);
+    Inst->Prepared = Prepared;
+  }
+  sendReply(Fd, Ready ? 0 : EAGAIN, 0);
+  close(Fd);
+
+  int ExitCode = EXIT_FAILURE;
+  if (Ready && Inst->Signal == 0) {
+    ExitCode = Run(Req, Prepared.get());
+  }
+  CurrentSignal = nullptr;
+
+  int Signal;
+  std::vector<int> Waiters;
+  {
+    std::lock_guard Lock(Mutex);
+    Inst->Done = true;
+    Inst->Prepared.reset();
+    Signal = Inst->Signal;
+    Waiters.swap(Inst->Waiters);
+    Instances.erase(Req.ContainerId);
+  }
+  if (Ready && Signal != 0) {
+    spdlog::info("instance {} killed by signal {}"sv, Req.ContainerId, Signal);
+    ExitCode = 128 + Signal;
+    Kill(Req, ExitCode);
+  }
+  spdlog::info("instance {} exited with {}"sv, Req.ContainerId, ExitCode);
+  for (const int Waiter : Waiters) {
+    sendReply(Waiter, Ready ? 0 : ESRCH, ExitCode);
+    close(Waiter);
+  }
+
+  Prepared.reset();
+  close(Req.ExecFifoFd);
+}
+
+} // namespace
+
+std::filesystem::path Host::socketPath(std::string_view Name) {
+  auto Path = std::filesystem::u8path(kStateDir) / kSocketDir /
+              std::filesystem::u8path(Name);
+  Path += kSocketSuffix;
+  return Path;
+}
+
+cxx20::expected<void, int> Host::serve(std::string_view Name,
+                                       PrepareFunc Prepare, RunFunc Run,
+                                       StopFunc Stop, KillFunc Kill) noexcept {
+  if (Name.empty() || Name.find('/') != std::string_view::npos) {
+    spdlog::error("invalid host name {}"sv, Name);
+    return cxx20::unexpected(EINVAL);
+  }
+  const auto Path = socketPath(Name);
+
+  // Every instance holds its exec fifo and the fds of its WASI environment
+  if (rlimit Limit; getrlimit(RLIMIT_NOFILE, &Limit) == 0 &&
+                    Limit.rlim_cur < Limit.rlim_max) {
+    Limit.rlim_cur = Limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &Limit) < 0) {
+      spdlog::info("raise fd limit failed: {}"sv, std::strerror(errno));
+    }
+  }
+
+  struct sigaction Action = {};
+  Action.sa_handler = interrupt;
+  sigemptyset(&Action.sa_mask);
+  if (sigaction(interruptSignal(), &Action, nullptr) < 0) {
+    spdlog::error("sigaction failed: {}"sv, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+
+  if (std::error_code ErrCode;
+      std::filesystem::create_directories(Path.parent_path(), ErrCode),
+      ErrCode) {
+    spdlog::error("create {} failed: {}"sv, Path.parent_path(),
+                  ErrCode.message());
+    return cxx20::unexpected(ErrCode.value());
+  }
+
+  int ListenFd;
+  if (auto Res = UnixSocket::listen(Path, SOCK_SEQPACKET)) {
+    ListenFd = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&ListenFd, &Path) {
+    close(ListenFd);
+    unlink(Path.c_str());
+  };
+  spdlog::info("host {} listening on {}"sv, Name, Path);
+
+  std::vector<char> Buffer(kMaxRequestSize);
+  while (true) {
+    const int Fd = accept4(ListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (Fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      spdlog::error("accept failed: {}"sv, std::strerror(errno));
+      return cxx20::unexpected(errno);
+    }
+    // Requests run bundles and kill instances with the rights of the host
+    if (!UnixSocket::trustedPeer(Fd)) {
+      close(Fd);
+      continue;
+    }
+
+    int PassedFd = -1;
+    alignas(cmsghdr) char Control[CMSG_SPACE(sizeof(int))];
+    iovec Iov = {Buffer.data(), Buffer.size()};
+    msghdr Msg = {};
+    Msg.msg_iov = &Iov;
+    Msg.msg_iovlen = 1;
+    Msg.msg_control = Control;
+    Msg.msg_controllen = sizeof(Control);
+    ssize_t Size;
+    do {
+      Size = recvmsg(Fd, &Msg, MSG_CMSG_CLOEXEC);
+    } while (Size < 0 && errno == EINTR);
+    for (cmsghdr *Cmsg = Size > 0 ? CMSG_FIRSTHDR(&Msg) : nullptr;
+         Cmsg != nullptr; Cmsg = CMSG_NXTHDR(&Msg, Cmsg)) {
+      if (Cmsg->cmsg_level == SOL_SOCKET && Cmsg->cmsg_type == SCM_RIGHTS &&
+          Cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+        std::memcpy(&PassedFd, CMSG_DATA(Cmsg), sizeof(int));
+      }
+    }
+    const auto Fields =
+        Size > 0 && !(Msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+            ? splitFields(std::string_view(Buffer.data() + 1, Size - 1))
+            : std::vector<std::string_view>{};
+    const char V = Size > 0 ? Buffer[0] : '\0';
+
+    if (V == kCreate && Fields.size() == 4 && PassedFd >= 0) {
+      auto Inst = std::make_shared<Instance>();
+      Inst->Req.ContainerRoot = std::filesystem::u8path(Fields[0]);
+      Inst->Req.ContainerId = Fields[1];
+      Inst->Req.PidFile = Fields[2];
+      Inst->Req.ConfigFileName = Fields[3];
+      Inst->Req.ExecFifoFd = PassedFd;
+
+      std::lock_guard Lock(Mutex);
+      if (!Instances.emplace(Inst->Req.ContainerId, Inst).second) {
+        spdlog::error("instance {} exists"sv, Inst->Req.ContainerId);
+        sendReply(Fd, EEXIST, 0);
+        close(Fd);
+        close(PassedFd);
+        continue;
+      }
+      std::thread Thread(runInstance, Inst, Fd, Path, Prepare, Run, Kill);
+      Inst->Thread = Thread.native_handle();
+      Inst->Started = true;
+      Thread.detach();
+      spdlog::info("instance {} started"sv, Inst->Req.ContainerId);
+      continue;
+    }
+
+    if (PassedFd >= 0) {
+      close(PassedFd);
+    }
+    if (V == kKill && Fields.size() == 2) {
+      int Signal = 0;
+      std::from_chars(Fields[1].data(), Fields[1].data() + Fields[1].size(),
+                      Signal);
+      std::lock_guard Lock(Mutex);
+      auto Iter = Instances.find(Fields[0]);
+      if (Iter == Instances.end() || Iter->second->Done) {
+        sendReply(Fd, ESRCH, 0);
+      } else {
+        auto &Inst = *Iter->second;
+        if (terminates(Signal)) {
+          int Expected = 0;
+          Inst.Signal.compare_exchange_strong(Expected, Signal);
+          if (Inst.Prepared != nullptr) {
+            Stop(Inst.Prepared.get());
+          }
+          // A call the thread enters after the signal still blocks, until the
+          // next kill, which the engine sends once the grace period is over
+          if (Inst.Started) {
+            pthread_kill(Inst.Thread, interruptSignal());
+          }
+        }
+        sendReply(Fd, 0, 0);
+      }
+    } else if (V == kWait && Fields.size() == 1) {
+      std::lock_guard Lock(Mutex);
+      auto Iter = Instances.find(Fields[0]);
+      if (Iter != Instances.end() && !Iter->second->Done) {
+        // Answered by the instance when it is done
+        Iter->second->Waiters.push_back(Fd);
+        continue;
+      }
+      sendReply(Fd, ESRCH, 0);
+    } else {
+      spdlog::error("malformed host request"sv);
+    }
+    close(Fd);
+  }
+}
+
+bool Host::stopping() noexcept {
+  return CurrentSignal != nullptr && *CurrentSignal != 0;
+}
+
+cxx20::expected<void, int> Host::request(std::string_view Name,
+                                         const Request &Req) noexcept {
+  if (Name.empty() || Name.find('/') != std::string_view::npos) {
+    return cxx20::unexpected(EINVAL);
+  }
+  int Fd;
+  if (auto Res = UnixSocket::connect(socketPath(Name), SOCK_SEQPACKET)) {
+    Fd = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&Fd) { close(Fd); };
+
+  std::string Message(1, kCreate);
+  std::error_code ErrCode;
+  for (const auto &Field :
+       {std::filesystem::absolute(Req.ContainerRoot, ErrCode).u8string(),
+        Req.ContainerId,
+        std::filesystem::absolute(std::filesystem::u8path(Req.PidFile),
+                                  ErrCode)
+            .u8string(),
+        Req.ConfigFileName}) {
+    Message += Field;
+    Message += '\0';
+  }
+  if (ErrCode || Message.size() > kMaxRequestSize) {
+    return cxx20::unexpected(EINVAL);
+  }
+
+  if (!sendMessage(Fd, Message, Req.ExecFifoFd)) {
+    spdlog::error("send host request failed: {}"sv, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+  auto Res = receiveReply(Fd);
+  if (!Res || Res->Error != 0) {
+    spdlog::info("host {} cannot start {}"sv, Name, Req.ContainerId);
+    return cxx20::unexpected(EAGAIN);
+  }
+  return {};
+}
+
+cxx20::expected<void, int>
+Host::kill(const std::filesystem::path &ContainerRoot,
+           std::string_view ContainerId, int Signal) noexcept {
+  auto Res = ask(ContainerRoot, kKill, ContainerId, std::to_string(Signal));
+  if (!Res) {
+    return cxx20::unexpected(Res.error());
+  }
+  if (Res->Error != 0) {
+    return cxx20::unexpected(Res->Error);
+  }
+  return {};
+}
+
+cxx20::expected<int, int>
+Host::wait(const std::filesystem::path &ContainerRoot,
+           std::string_view ContainerId) noexcept {
+  auto Res = ask(ContainerRoot, kWait, ContainerId, {});
+  if (!Res) {
+    return cxx20::unexpected(Res.error());
+  }
+  if (Res->Error != 0) {
+    return cxx20::unexpected(Res->Error);
+  }
+  return Res->ExitCode;
+}
+
+} // namespace RUNW
@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "runw.h"
+#include "bundle.h"
+#include "config.h"
+#include "daemon.h"
+#include "lifecycle.h"
+#include "state.h"
+#include <algorithm>
+#include <common/log.h>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <spdlog/sinks/null_sink.h>
+#include <string>
+#include <vector>
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+using namespace std::literals;
+
+struct runw_context {
+  std::string Root;
+  std::string Helper;
+  std::string ConfigFileName = "config.json"s;
+};
+
+struct runw_bundle {
+  RUNW::Bundle Owned;
+  const RUNW::Bundle *Config = &Owned;
+};
+
+struct runw_state {
+  RUNW::State State;
+  runw_bundle Bundle;
+};
+
+namespace {
+
+int errorCode(const cxx20::expected<void, int> &Res) noexcept {
+  return Res ? 0 : Res.error();
+}
+
+/// Errors are returned, not logged to the stdout of the embedding process.
+/// The logger is the default of the copy of spdlog inside the library, which
+/// does not export it, so a process using spdlog itself keeps its own.
+void silenceLog() noexcept {
+  static std::once_flag Once;
+  std::call_once(Once, []() {
+    spdlog::set_default_logger(std::make_shared<spdlog::logger>(
+        "runw", std::make_shared<spdlog::sinks::null_sink_mt>()));
+  });
+}
+
+/// Smallest size of runw_create_options, that of the first version of it
+constexpr size_t kMinCreateOptionsSize =
+    offsetof(runw_create_options, systemd_cgroup) + sizeof(int);
+
+/// Run the command line with the helper and return its wait status.
+cxx20::expected<int, int> spawnHelper(const std::string &Helper,
+                                      std::vector<const char *> &Argv) {
+  Argv.push_back(nullptr);
+  pid_t Pid;
+  if (const int Err =
+          posix_spawnp(&Pid, Helper.c_str(), nullptr, nullptr,
+                       const_cast<char *const *>(Argv.data()), environ);
+      Err != 0) {
+    return cxx20::unexpected(Err);
+  }
+
+  int Status;
+  while (waitpid(Pid, &Status, 0) < 0) {
+    if (errno != EINTR) {
+      return cxx20::unexpected(errno);
+    }
+  }
+  return Status;
+}
+
+} // namespace
+
+extern "C" {
+
+const char *runw_version(void) { return RUNW::kVersionString.data(); }
+
+int runw_context_new(const char *root, const char *helper,
+                     runw_context **context) {
+  if (context == nullptr) {
+    return EINVAL;
+  }
+  silenceLog();
+
+  auto *Context = new (std::nothrow) runw_context;
+  if (Context == nullptr) {
+    return ENOMEM;
+  }
+  Context->Root = root ? root : std::string(RUNW::kContainerDir);
+  Context->Helper = helper ? helper : "runw-vm"s;
+  *context = Context;
+  return 0;
+}
+
+void runw_context_free(runw_context *context) { delete context; }
+
+int runw_context_set_config(runw_context *context,
+                            const char *config_file_name) {
+  if (context == nullptr || config_file_name == nullptr ||
+      *config_file_name == '\0') {
+    return EINVAL;
+  }
+  context->ConfigFileName = config_file_name;
+  return 0;
+}
+
+int runw_create(runw_context *context, const char *id, const char *bundle,
+                const runw_create_options *options) {
+  if (context == nullptr || id == nullptr || bundle == nullptr ||
+      (options != nullptr && options->size < kMinCreateOptionsSize)) {
+    return EINVAL;
+  }
+
+  // Callers built against an older header pass a shorter struct, whose
+  // missing fields stay zero here
+  runw_create_options Options = {};
+  if (options != nullptr) {
+    std::memcpy(&Options, options, std::min(options->size, sizeof(Options)));
+  }
+
+  std::vector<const char *> Argv = {
+      context->Helper.c_str(), "--root",   context->Root.c_str(),
+      "--config",              context->ConfigFileName.c_str()};
+  if (Options.systemd_cgroup) {
+    Argv.push_back("--systemd-cgroup");
+  }
+  if (Options.use_services) {
+    Argv.push_back("--use-services");
+  }
+  Argv.insert(Argv.end(), {"create", "--bundle", bundle});
+  if (Options.pid_file != nullptr) {
+    Argv.insert(Argv.end(), {"--pid-file", Options.pid_file});
+  }
+  if (Options.console_socket != nullptr) {
+    Argv.insert(Argv.end(), {"--console-socket", Options.console_socket});
+  }
+  Argv.push_back(id);
+
+  // The helper only reports success or failure, so the failures that can be
+  // told apart without the VM are checked here first
+  std::error_code ErrCode;
+  if (std::filesystem::exists(std::filesystem::u8path(context->Root) / id,
+                              ErrCode)) {
+    return EEXIST;
+  }
+  if (!std::filesystem::is_directory(std::filesystem::u8path(bundle),
+                                     ErrCode)) {
+    return ErrCode ? ErrCode.value() : ENOENT;
+  }
+  if (RUNW::Bundle Config; !Config.load(std::filesystem::u8path(bundle),
+                                        context->ConfigFileName)) {
+    return EINVAL;
+  }
+
+  // The daemon would be the parent of the container process, not the caller
+  if (Options.use_services) {
+    if (auto Res = RUNW::Daemon::forward(static_cast<int>(Argv.size()),
+                                         Argv.data())) {
+      return *Res == EXIT_SUCCESS ? 0 : EIO;
+    }
+  }
+
+  auto Res = spawnHelper(context->Helper, Argv);
+  if (!Res) {
+    return Res.error();
+  }
+  if (!WIFEXITED(*Res)) {
+    return ECHILD;
+  }
+  if (WEXITSTATUS(*Res) != EXIT_SUCCESS) {
+    return EIO;
+  }
+  return 0;
+}
+
+int runw_start(runw_context *context, const char *id) {
+  if (context == nullptr || id == nullptr) {
+    return EINVAL;
+  }
+  return errorCode(
+      RUNW::Lifecycle::start(context->Root, context->ConfigFileName, id));
+}
+
+int runw_kill(runw_context *context, const char *id, int signal) {
+  if (context == nullptr || id == nullptr || signal < 0) {
+    return EINVAL;
+  }
+  return errorCode(RUNW::Lifecycle::kill(context->Root,
+                                         context->ConfigFileName, id, signal));
+}
+
+int runw_delete(runw_context *context, const char *id, int force) {
+  if (context == nullptr || id == nullptr) {
+    return EINVAL;
+  }
+  return errorCode(RUNW::Lifecycle::remove(context->Root, id, force != 0));
+}
+
+int runw_wait(runw_context *context, const char *id, int *exit_code) {
+  if (context == nullptr || id == nullptr || exit_code == nullptr) {
+    return EINVAL;
+  }
+  auto Res = RUNW::Lifecycle::wait(context->Root, context->ConfigFileName, id);
+  if (!Res) {
+    return Res.error();
+  }
+  *exit_code = *Res;
+  return 0;
+}
+
+int runw_state_load(runw_context *context, const char *id,
+                    runw_state **state) {
+  if (context == nullptr || id == nullptr || state == nullptr) {
+    return EINVAL;
+  }
+  auto Res = RUNW::Lifecycle::state(context->Root, context->ConfigFileName, id);
+  if (!Res) {
+    return Res.error();
+  }
+
+  auto *State = new (std::nothrow) runw_state;
+  if (State == nullptr) {
+    return ENOMEM;
+  }
+  State->State = std::move(*Res);
+  State->Bundle.Config = &State->State.bundle();
+  *state = State;
+  return 0;
+}
+
+void runw_state_free(runw_state *state) { delete state; }
+
+const char *runw_state_id(const runw_state *state) {
+  return state->State.containerId().data();
+}
+
+runw_status runw_state_status(const runw_state *state) {
+  switch (state->State.getStatus()) {
+  case RUNW::State::StatusCode::Creating:
+    return RUNW_STATUS_CREATING;
+  case RUNW::State::StatusCode::Created:
+    return RUNW_STATUS_CREATED;
+  case RUNW::State::StatusCode::Running:
+    return RUNW_STATUS_RUNNING;
+  case RUNW::State::StatusCode::Stopped:
+    return RUNW_STATUS_STOPPED;
+  default:
+    return RUNW_STATUS_UNKNOWN;
+  }
+}
+
+pid_t runw_state_pid(const runw_state *state) {
+  return state->State.getPid();
+}
+
+int runw_state_exit_code(const runw_state *state) {
+  return state->State.getExitCode();
+}
+
+const char *runw_state_bundle_path(const runw_state *state) {
+  return state->State.bundlePath().data();
+}
+
+const char *runw_state_created(const runw_state *state) {
+  return state->State.createdTimestamp().data();
+}
+
+const char *runw_state_started(const runw_state *state) {
+  return state->State.startedTimestamp().data();
+}
+
+const char *runw_state_finished(const runw_state *state) {
+  return state->State.finishedTimestamp().data();
+}
+
+const runw_bundle *runw_state_bundle(const runw_state *state) {
+  return &state->Bundle;
+}
+
+int runw_bundle_load(const char *path, const char *config_file_name,
+                     runw_bundle **bundle) {
+  if (path == nullptr || bundle == nullptr) {
+    return EINVAL;
+  }
+  auto *Bundle = new (std::nothrow) runw_bundle;
+  if (Bundle == nullptr) {
+    return ENOMEM;
+  }
+  if (!Bundle->Owned.load(std::filesystem::u8path(path),
+                          config_file_name ? config_file_name
+                                           : "config.json"sv)) {
+    delete Bundle;
+    return EINVAL;
+  }
+  *bundle = Bundle;
+  return 0;
+}
+
+void runw_bundle_free(runw_bundle *bundle) { delete bundle; }
+
+const char *runw_bundle_root_path(const runw_bundle *bundle) {
+  return bundle->Config->rootPath().data();
+}
+
+const char *runw_bundle_cwd(const runw_bundle *bundle) {
+  return bundle->Config->cwd().data();
+}
+
+size_t runw_bundle_arg_count(const runw_bundle *bundle) {
+  return bundle->Config->args().size();
+}
+
+const char *runw_bundle_arg(const runw_bundle *bundle, size_t index) {
+  const auto Args = bundle->Config->args();
+  return index < Args.size() ? Args[index].c_str() : nullptr;
+}
+
+size_t runw_bundle_env_count(const runw_bundle *bundle) {
+  return bundle->Config->envs().size();
+}
+
+const char *runw_bundle_env(const runw_bundle *bundle, size_t index) {
+  const auto Envs = bundle->Config->envs();
+  return index < Envs.size() ? Envs[index].c_str() : nullptr;
+}
+
+const char *runw_bundle_cgroups_path(const runw_bundle *bundle) {
+  return bundle->Config->linuxCgroupsPath().data();
+}
+
+} // extern "C"
@@ -0,0 +1,401 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "lifecycle.h"
+#include "aotcache.h"
+#include "host.h"
+#include "pidfd.h"
+#include "state.h"
+#include <algorithm>
+#include <boost/scope_exit.hpp>
+#include <common/log.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <unordered_map>
+
+#ifdef RUNW_OS_LINUX
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+#if defined(RUNW_OS_LINUX)
+const std::string_view kSignalFile = "signal"sv;
+
+/// Remember the last signal sent to the container process that ends it by
+/// default. Only the parent of the process learns how it died, so wait falls
+/// back to this when the container exited without recording an exit code.
+void recordSignal(const std::filesystem::path &ContainerRoot,
+                  int Signal) noexcept {
+  switch (Signal) {
+  case 0:
+  case SIGCHLD:
+  case SIGCONT:
+  case SIGSTOP:
+  case SIGTSTP:
+  case SIGTTIN:
+  case SIGTTOU:
+  case SIGURG:
+  case SIGWINCH:
+    return;
+  default:
+    break;
+  }
+  std::ofstream Stream(ContainerRoot / kSignalFile, std::ios::trunc);
+  Stream << Signal;
+}
+
+int recordedSignal(const std::filesystem::path &ContainerRoot) noexcept {
+  std::ifstream Stream(ContainerRoot / kSignalFile);
+  int Signal;
+  if (!(Stream >> Signal)) {
+    return -1;
+  }
+  return Signal;
+}
+#endif
+
+int parseNumeric(std::string_view Name) {
+  if (Name.empty()) {
+    return -1;
+  }
+  int Value = 0;
+  for (const char C : Name) {
+    if (isdigit(C)) {
+      Value = Value * 10 + (C - '0');
+    } else {
+      return -1;
+    }
+  }
+
+  return Value;
+}
+
+} // namespace
+
+int Lifecycle::parseSignal(std::string_view Name) noexcept {
+  if (const int Value = parseNumeric(Name); Value != -1) {
+    return Value;
+  }
+
+  // Try name parsing
+  std::string Upper(Name.size(), '\0');
+  std::transform(Name.begin(), Name.end(), Upper.begin(),
+                 [](char C) { return std::toupper(C); });
+
+  if (std::string_view(Upper).substr(0, 3) != "SIG"sv) {
+    Upper = "SIG"s + Upper;
+  }
+  static const std::unordered_map<std::string, int> kSignalNames = {
+#if defined(RUNW_OS_LINUX)
+    {"SIGABRT", SIGABRT},
+    {"SIGALRM", SIGALRM},
+    {"SIGBUS", SIGBUS},
+    {"SIGCHLD", SIGCHLD},
+    {"SIGCONT", SIGCONT},
+    {"SIGFPE", SIGFPE},
+    {"SIGHUP", SIGHUP},
+    {"SIGILL", SIGILL},
+    {"SIGINT", SIGINT},
+    {"SIGIO", SIGIO},
+    {"SIGKILL", SIGKILL},
+    {"SIGPIPE", SIGPIPE},
+    {"SIGPROF", SIGPROF},
+    {"SIGPWR", SIGPWR},
+    {"SIGQUIT", SIGQUIT},
+    {"SIGSEGV", SIGSEGV},
+    {"SIGSTKFLT", SIGSTKFLT},
+    {"SIGSTOP", SIGSTOP},
+    {"SIGSYS", SIGSYS},
+    {"SIGTERM", SIGTERM},
+    {"SIGTRAP", SIGTRAP},
+    {"SIGTSTP", SIGTSTP},
+    {"SIGTTIN", SIGTTIN},
+    {"SIGTTOU", SIGTTOU},
+    {"SIGURG", SIGURG},
+    {"SIGUSR1", SIGUSR1},
+    {"SIGUSR2", SIGUSR2},
+    {"SIGVTALRM", SIGVTALRM},
+    {"SIGWINCH", SIGWINCH},
+    {"SIGXCPU", SIGXCPU},
+    {"SIGXFSZ", SIGXFSZ},
+#elif defined(RUNW_OS_MACOS)
+    {"SIGABRT", SIGABRT},
+    {"SIGALRM", SIGALRM},
+    {"SIGBUS", SIGBUS},
+    {"SIGCHLD", SIGCHLD},
+    {"SIGCONT", SIGCONT},
+    {"SIGEMT", SIGEMT},
+    {"SIGFPE", SIGFPE},
+    {"SIGHUP", SIGHUP},
+    {"SIGILL", SIGILL},
+    {"SIGINFO", SIGINFO},
+    {"SIGINT", SIGINT},
+    {"SIGIO", SIGIO},
+    {"SIGKILL", SIGKILL},
+    {"SIGPIPE", SIGPIPE},
+    {"SIGPROF", SIGPROF},
+    {"SIGQUIT", SIGQUIT},
+    {"SIGSEGV", SIGSEGV},
+    {"SIGSTOP", SIGSTOP},
+    {"SIGSYS", SIGSYS},
+    {"SIGTERM", SIGTERM},
+    {"SIGTRAP", SIGTRAP},
+    {"SIGTSTP", SIGTSTP},
+    {"SIGTTIN", SIGTTIN},
+    {"SIGTTOU", SIGTTOU},
+    {"SIGURG", SIGURG},
+    {"SIGUSR1", SIGUSR1},
+    {"SIGUSR2", SIGUSR2},
+    {"SIGVTALRM", SIGVTALRM},
+    {"SIGWINCH", SIGWINCH},
+    {"SIGXCPU", SIGXCPU},
+    {"SIGXFSZ", SIGXFSZ},
+#elif defined(RUNW_OS_SOLARIS)
+    {"SIGALRM", SIGALRM},
+    {"SIGBUS", SIGBUS},
+    {"SIGCANCEL", SIGCANCEL},
+    {"SIGCHLD", SIGCHLD},
+    {"SIGCONT", SIGCONT},
+    {"SIGEMT", SIGEMT},
+    {"SIGFPE", SIGFPE},
+    {"SIGFREEZE", SIGFREEZE},
+    {"SIGHUP", SIGHUP},
+    {"SIGILL", SIGILL},
+    {"SIGINT", SIGINT},
+    {"SIGJVM1", SIGJVM1},
+    {"SIGJVM2", SIGJVM2},
+    {"SIGKILL", SIGKILL},
+    {"SIGLOST", SIGLOST},
+    {"SIGLWP", SIGLWP},
+    {"SIGPIPE", SIGPIPE},
+    {"SIGPOLL", SIGPOLL},
+    {"SIGPROF", SIGPROF},
+    {"SIGPWR", SIGPWR},
+    {"SIGQUIT", SIGQUIT},
+    {"SIGSEGV", SIGSEGV},
+    {"SIGSTOP", SIGSTOP},
+    {"SIGSYS", SIGSYS},
+    {"SIGTERM", SIGTERM},
+    {"SIGTHAW", SIGTHAW},
+    {"SIGTRAP", SIGTRAP},
+    {"SIGTSTP", SIGTSTP},
+    {"SIGTTIN", SIGTTIN},
+    {"SIGTTOU", SIGTTOU},
+    {"SIGURG", SIGURG},
+    {"SIGUSR1", SIGUSR1},
+    {"SIGUSR2", SIGUSR2},
+    {"SIGVTALRM", SIGVTALRM},
+    {"SIGWAITING", SIGWAITING},
+    {"SIGWINCH", SIGWINCH},
+    {"SIGXCPU", SIGXCPU},
+    {"SIGXFSZ", SIGXFSZ},
+    {"SIGXRES", SIGXRES},
+#elif defined(RUNW_OS_WINDOWS)
+    {"SIGABRT", SIGABRT},
+    {"SIGFPE", SIGFPE},
+    {"SIGILL", SIGILL},
+    {"SIGINT", SIGINT},
+    {"SIGSEGV", SIGSEGV},
+    {"SIGTERM", SIGTERM},
+#endif
+  };
+
+  if (auto Iter = kSignalNames.find(Upper); Iter != kSignalNames.end()) {
+    return Iter->second;
+  }
+  return -1;
+}
+
+cxx20::expected<void, int> Lifecycle::remove(std::string_view Root,
+                                             std::string_view ContainerId,
+                                             bool Force) noexcept {
+  const auto ContainerRoot = std::filesystem::u8path(Root) / ContainerId;
+
+  if (std::error_code ErrCode;
+      !std::filesystem::is_directory(ContainerRoot, ErrCode)) {
+    spdlog::error(ErrCode.message());
+    if (!Force) {
+      return cxx20::unexpected(ErrCode ? ErrCode.value() : ENOENT);
+    }
+  }
+
+  AOTCache::release(ContainerRoot);
+
+  if (std::error_code ErrCode;
+      std::filesystem::remove_all(ContainerRoot, ErrCode), ErrCode) {
+    spdlog::error(ErrCode.message());
+    if (!Force) {
+      return cxx20::unexpected(ErrCode.value());
+    }
+  }
+
+  return {};
+}
+
+cxx20::expected<void, int> Lifecycle::kill(std::string_view Root,
+                                           std::string_view ConfigFileName,
+                                           std::string_view ContainerId,
+                                           int Signal) noexcept {
+  State State;
+  if (auto Res = state(Root, ConfigFileName, ContainerId)) {
+    State = std::move(*Res);
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+
+#if defined(RUNW_OS_LINUX)
+  const auto ContainerRoot = std::filesystem::u8path(Root) / ContainerId;
+  // Instances of a host share its pid, only the host can signal them
+  if (auto Res = Host::kill(ContainerRoot, ContainerId, Signal);
+      Res || Res.error() != ENOENT) {
+    return Res;
+  }
+  if (auto Fd = PidFd::connect(ContainerRoot)) {
+    BOOST_SCOPE_EXIT_ALL(&Fd) { close(*Fd); };
+    recordSignal(ContainerRoot, Signal);
+    return PidFd::sendSignal(*Fd, Signal);
+  } else if (Fd.error() != ENOENT) {
+    spdlog::error("container {} is not running"sv, ContainerId);
+    return cxx20::unexpected(ESRCH);
+  }
+#endif
+
+  // Containers started without a pidfd holder
+  const pid_t PidValue = State.getPid();
+  if (PidValue < 0) {
+    return cxx20::unexpected(ESRCH);
+  }
+
+#if defined(RUNW_OS_LINUX)
+  recordSignal(ContainerRoot, Signal);
+#endif
+#if defined(RUNW_OS_LINUX) || defined(RUNW_OS_MACOS) || defined(RUNW_OS_SOLARIS)
+  if (::kill(PidValue, Signal) != 0) {
+    return cxx20::unexpected(errno);
+  }
+#elif defined(RUNW_OS_WINDOWS)
+  // TODO: Support signal
+  return cxx20::unexpected(ENOTSUP);
+#endif
+
+  return {};
+}
+
+cxx20::expected<int, int>
+Lifecycle::wait(std::string_view Root, std::string_view ConfigFileName,
+                std::string_view ContainerId) noexcept {
+  const auto ContainerRoot = std::filesystem::u8path(Root) / ContainerId;
+  if (auto Res = Host::wait(ContainerRoot, ContainerId)) {
+    return *Res;
+  } else if (Res.error() != ENOENT) {
+    // The instance has exited and recorded its exit code
+  } else if (auto Fd = PidFd::connect(ContainerRoot)) {
+    BOOST_SCOPE_EXIT_ALL(&Fd) { close(*Fd); };
+    pollfd PollFd = {*Fd, POLLIN, 0};
+    while (poll(&PollFd, 1, -1) < 0) {
+      if (errno != EINTR) {
+        const int Err = errno;
+        spdlog::error("poll pidfd failed: {}"sv, std::strerror(Err));
+        return cxx20::unexpected(Err);
+      }
+    }
+  } else if (Fd.error() == ENOENT) {
+    // Containers started without a pidfd holder
+    auto Res = state(Root, ConfigFileName, ContainerId);
+    if (!Res) {
+      return cxx20::unexpected(Res.error());
+    }
+    if (const pid_t PidValue = Res->getPid(); PidValue > 0) {
+      while (::kill(PidValue, 0) == 0 || errno == EPERM) {
+        std::this_thread::sleep_for(100ms);
+      }
+    }
+  }
+
+  // The container records its exit code before it exits
+  auto Res = state(Root, ConfigFileName, ContainerId);
+  if (!Res) {
+    return cxx20::unexpected(Res.error());
+  }
+  if (Res->getStatus() != State::StatusCode::Stopped) {
+#if defined(RUNW_OS_LINUX)
+    // Killed before it could record anything, report it like a shell does
+    if (const int Signal = recordedSignal(ContainerRoot); Signal > 0) {
+      return 128 + Signal;
+    }
+#endif
+    spdlog::error("container {} exited without an exit code"sv, ContainerId);
+    return cxx20::unexpected(ECHILD);
+  }
+  return Res->getExitCode();
+}
+
+cxx20::expected<void, int>
+Lifecycle::start(std::string_view Root, std::string_view ConfigFileName,
+                 std::string_view ContainerId) noexcept {
+  if (auto Res = state(Root, ConfigFileName, ContainerId); !Res) {
+    return cxx20::unexpected(Res.error());
+  }
+
+  const auto ContainerRoot = std::filesystem::u8path(Root) / ContainerId;
+  const auto ExecFifoFile = ContainerRoot / "exec.fifo"sv;
+
+  int ExecFifoFd = open(ExecFifoFile.u8string().c_str(), O_WRONLY | O_NONBLOCK);
+  BOOST_SCOPE_EXIT_ALL(&ExecFifoFd) {
+    if (ExecFifoFd >= 0) {
+      close(ExecFifoFd);
+    }
+  };
+  if (ExecFifoFd < 0) {
+    const int Err = errno;
+    spdlog::error("open fifo failed: {}"sv, std::strerror(Err));
+    return cxx20::unexpected(Err);
+  }
+
+  if (int Ret = unlink(ExecFifoFile.u8string().c_str()); Ret < 0) {
+    const int Err = errno;
+    spdlog::error("unlink exec fifo failed: {}"sv, std::strerror(Err));
+    return cxx20::unexpected(Err);
+  }
+
+  char Buffer[1] = {};
+  if (int Ret = write(ExecFifoFd, Buffer, sizeof(Buffer)); Ret < 0) {
+    const int Err = errno;
+    spdlog::error("read exec fifo failed: {}"sv, std::strerror(Err));
+    return cxx20::unexpected(Err);
+  }
+
+  return {};
+}
+
+cxx20::expected<State, int>
+Lifecycle::state(std::string_view Root, std::string_view ConfigFileName,
+                 std::string_view ContainerId) noexcept {
+  const auto StateFile =
+      std::filesystem::u8path(Root) / ContainerId / "state.json"sv;
+  if (std::error_code ErrCode;
+      !std::filesystem::is_regular_file(StateFile, ErrCode)) {
+    spdlog::error("container {} not found"sv, ContainerId);
+    return cxx20::unexpected(ErrCode ? ErrCode.value() : ENOENT);
+  }
+
+  State State;
+  if (!State.load(StateFile, ConfigFileName)) {
+    spdlog::error("load {} failed"sv, StateFile);
+    return cxx20::unexpected(EINVAL);
+  }
+  return State;
+}
+
+} // namespace RUNW
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "lifecycle.h"
+#include "options.h"
+#include <common/log.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+std::vector<char> readAll(const std::filesystem::path &Path) {
+  std::error_code ErrCode;
+  if (!std::filesystem::is_regular_file(Path, ErrCode) || ErrCode) {
+    return {};
+  }
+
+  const auto Size = std::filesystem::file_size(Path, ErrCode);
+  if (ErrCode) {
+    return {};
+  }
+
+  std::ifstream Stream(Path);
+  if (!Stream) {
+    return {};
+  }
+
+  std::vector<char> Buffer(Size);
+  Stream.read(Buffer.data(), Size);
+  Buffer.resize(Stream.gcount());
+  return Buffer;
+}
+
+int exitCode(const cxx20::expected<void, int> &Res) noexcept {
+  return Res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // namespace
+
+int Lifecycle::command(const Options &Opts) noexcept {
+  const auto Root = Opts.Root.value();
+  const auto ConfigFileName = Opts.ConfigFileName.value();
+  const auto ContainerId = Opts.ContainerId.value();
+
+  if (Opts.Start.is_selected()) {
+    return exitCode(start(Root, ConfigFileName, ContainerId));
+  } else if (Opts.Delete.is_selected()) {
+    return exitCode(remove(Root, ContainerId, Opts.Force.value()));
+  } else if (Opts.Kill.is_selected()) {
+    const int Signal = parseSignal(Opts.Signal.value());
+    if (Signal < 0) {
+      spdlog::error("unknown signal {}"sv, Opts.Signal.value());
+      return EXIT_FAILURE;
+    }
+    return exitCode(kill(Root, ConfigFileName, ContainerId, Signal));
+  } else if (Opts.Wait.is_selected()) {
+    if (auto Res = wait(Root, ConfigFileName, ContainerId)) {
+      return *Res;
+    }
+    return EXIT_FAILURE;
+  } else if (Opts.State.is_selected()) {
+    // Print the state file as written, cri-o parses it
+    const auto StateFile =
+        std::filesystem::u8path(Root) / ContainerId / "state.json"sv;
+    auto Data = readAll(StateFile);
+    if (Data.empty()) {
+      spdlog::error("container {} not found"sv, ContainerId);
+      return EXIT_FAILURE;
+    }
+    std::cout << std::string_view(Data.data(), Data.size()) << std::endl;
+    return EXIT_SUCCESS;
+  }
+  return EXIT_FAILURE;
+}
+
+} // namespace RUNW
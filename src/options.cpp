@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "options.h"
+#include "config.h"
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace PO = WasmEdge::PO;
+
+Options::Options()
+    : Create(PO::Description("Create a container"sv)),
+      Delete(
+          PO::Description("Delete any resources held by the container"sv)),
+      Kill(PO::Description(
+          "Kill sends the specified signal to the container's init process"sv)),
+      Start(PO::Description(
+          "Executes the user defined process in a created container"sv)),
+      State(PO::Description("Output the state of a container"sv)),
+      Wait(PO::Description(
+          "Wait for the container's init process to exit and exit with its "
+          "exit code"sv)),
+      Cache(PO::Description(
+          "Manage the AOT cache: gc evicts and moves artifacts between tiers, "
+          "stats and ls report usage"sv)),
+      Precompile(PO::Description(
+          "Compile wasm modules of bundles, image root filesystems or "
+          "directories into the AOT cache"sv)),
+      Snapshot(PO::Description(
+          "Run the snapshot init export of a bundle and save the initialized "
+          "state for its containers to start from"sv)),
+      Zygote(PO::Description(
+          "Keep instantiated modules warm and fork containers of already "
+          "compiled modules from them"sv)),
+      Host(PO::Description(
+          "Run the containers that name this host in their org.wasmedge.host "
+          "annotation as threads of one process"sv)),
+      CompileServer(PO::Description(
+          "Serve AOT compile requests of containers created on this node"sv)),
+      Daemon(PO::Description(
+          "Serve create, start, kill, delete, state and wait of runw "
+          "invocations on this node, without starting a new runtime for "
+          "each"sv)),
+
+      Root(PO::Description("Root path"sv), PO::MetaVar("PATH"sv),
+           PO::DefaultValue<std::string>(std::string(kContainerDir))),
+      SystemdCgroup(PO::Description(
+          "enable systemd cgroup support, expects cgroupsPath to be of form "
+          "\"slice:prefix:name\" for e.g. \"system.slice:runc:434234\""sv)),
+      ConfigFileName(PO::Description("Override the config file name"sv),
+                     PO::MetaVar("FILENAME"sv),
+                     PO::DefaultValue<std::string>("config.json"s)),
+      UseServices(PO::Description(
+          "let the daemon, a zygote or a host create the container process, "
+          "which leaves it a child of theirs that the caller cannot wait for; "
+          "leave off under a subreaper such as conmon or containerd-shim"sv)),
+
+      AOTCpuWeight(
+          PO::Description("cpu.weight of AOT compiles, 0 for the default"sv),
+          PO::MetaVar("WEIGHT"sv), PO::DefaultValue<uint64_t>(0)),
+      AOTCpuMax(PO::Description("cpu.max of AOT compiles in percent of one "
+                                "cpu, 0 for no limit"sv),
+                PO::MetaVar("PERCENT"sv), PO::DefaultValue<uint64_t>(0)),
+      AOTMemoryMax(
+          PO::Description("memory.max of AOT compiles, 0 for no limit"sv),
+          PO::MetaVar("BYTES"sv), PO::DefaultValue<uint64_t>(0)),
+
+      ContainerId(PO::Description("Container ID"sv), PO::MetaVar("ID"sv)),
+      Path(PO::Description("Path to the root of the bundle directory, "
+                           "defaults to the current directory"sv),
+           PO::MetaVar("PATH"sv)),
+      ConsoleSocket(
+          PO::Description(
+              "Path to an AF_UNIX socket which will receive a file descriptor "
+              "referencing the master end of the console's pseudoterminal"sv),
+          PO::MetaVar("FD"sv), PO::DefaultValue<std::string>({})),
+      PidFile(PO::Description("Specify the file to write the process id to"sv),
+              PO::MetaVar("PATH"sv)),
+
+      Force(PO::Description("Forcibly deletes the container if it is still "
+                            "running (uses SIGKILL)"sv)),
+
+      Signal(PO::Description("Signal name"sv),
+             PO::DefaultValue<std::string>("SIGTERM"s),
+             PO::MetaVar("SIGNAL"sv)),
+
+      SnapshotBundle(
+          PO::Description("Path to the root of the bundle directory"sv),
+          PO::MetaVar("PATH"sv)),
+      PrecompilePaths(
+          PO::Description("Bundles, directories or wasm files to compile"sv),
+          PO::MetaVar("PATH"sv)),
+      CacheAction(PO::Description("One of gc, stats or ls"sv),
+                  PO::MetaVar("ACTION"sv)),
+      MaxSize(PO::Description("Evict least recently used artifacts until the "
+                              "cache fits in this many bytes, 0 for no "
+                              "limit"sv),
+              PO::MetaVar("BYTES"sv), PO::DefaultValue<uint64_t>(0)),
+      HotSize(PO::Description("Keep the most recently used artifacts that fit "
+                              "in this many bytes in the tmpfs hot tier, 0 to "
+                              "disable"sv),
+              PO::MetaVar("BYTES"sv), PO::DefaultValue<uint64_t>(0)),
+      Jobs(PO::Description("Number of modules compiled in parallel, defaults "
+                           "to the number of available cpus"sv),
+           PO::MetaVar("N"sv), PO::DefaultValue<uint32_t>(0)),
+      MaxInstances(
+          PO::Description("Number of modules kept instantiated, 0 for no "
+                          "limit"sv),
+          PO::MetaVar("N"sv), PO::DefaultValue<uint32_t>(16)),
+      HostName(PO::Description("Name of the host"sv), PO::MetaVar("NAME"sv)),
+      HottestFirst(PO::Description("Compile modules with the most recorded "
+                                   "run time first"sv)) {}
+
+bool Options::parse(int Argc, const char *Argv[]) {
+  if (!Parser.add_option("root"sv, Root)
+           .add_option("systemd-cgroup"sv, SystemdCgroup)
+           .add_option("config"sv, ConfigFileName)
+           .add_option("use-services"sv, UseServices)
+           .add_option("aot-cpu-weight"sv, AOTCpuWeight)
+           .add_option("aot-cpu-max"sv, AOTCpuMax)
+           .add_option("aot-memory-max"sv, AOTMemoryMax)
+           .begin_subcommand(Create, "create"sv)
+           .add_option(ContainerId)
+           .add_option("bundle"sv, Path)
+           .add_option("console-socket"sv, ConsoleSocket)
+           .add_option("pid-file"sv, PidFile)
+           .end_subcommand()
+           .begin_subcommand(Delete, "delete"sv)
+           .add_option(ContainerId)
+           .add_option("force"sv, Force)
+           .end_subcommand()
+           .begin_subcommand(Kill, "kill"sv)
+           .add_option(ContainerId)
+           .add_option(Signal)
+           .end_subcommand()
+           .begin_subcommand(Start, "start"sv)
+           .add_option(ContainerId)
+           .end_subcommand()
+           .begin_subcommand(State, "state"sv)
+           .add_option(ContainerId)
+           .end_subcommand()
+           .begin_subcommand(Wait, "wait"sv)
+           .add_option(ContainerId)
+           .end_subcommand()
+           .begin_subcommand(Cache, "cache"sv)
+           .add_option(CacheAction)
+           .add_option("max-size"sv, MaxSize)
+           .add_option("hot-size"sv, HotSize)
+           .end_subcommand()
+           .begin_subcommand(Precompile, "precompile"sv)
+           .add_option(PrecompilePaths)
+           .add_option("jobs"sv, Jobs)
+           .add_option("hottest-first"sv, HottestFirst)
+           .end_subcommand()
+           .begin_subcommand(Snapshot, "snapshot"sv)
+           .add_option(SnapshotBundle)
+           .end_subcommand()
+           .begin_subcommand(Zygote, "zygote"sv)
+           .add_option("max-instances"sv, MaxInstances)
+           .end_subcommand()
+           .begin_subcommand(Host, "host"sv)
+           .add_option(HostName)
+           .end_subcommand()
+           .begin_subcommand(CompileServer, "compile-server"sv)
+           .add_option("jobs"sv, Jobs)
+           .end_subcommand()
+           .begin_subcommand(Daemon, "daemon"sv)
+           .end_subcommand()
+           .parse(Argc, Argv)) {
+    return false;
+  }
+
+  if (ConfigFileName.value().empty()) {
+    ConfigFileName.default_argument();
+  }
+  return true;
+}
+
+bool Options::isLifecycle() const noexcept {
+  return Delete.is_selected() || Kill.is_selected() || Start.is_selected() ||
+         State.is_selected() || Wait.is_selected();
+}
+
+CGroup::Resources Options::compileLimits() const noexcept {
+  CGroup::Resources Limits;
+  Limits.CPUWeight = AOTCpuWeight.value();
+  Limits.CPUQuotaPercent = AOTCpuMax.value();
+  Limits.MemoryMax = AOTMemoryMax.value();
+  return Limits;
+}
+
+} // namespace RUNW
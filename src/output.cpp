@@ -0,0 +1,279 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "output.h"
+#include <algorithm>
+#include <boost/scope_exit.hpp>
+#include <common/log.h>
+#include <csignal>
+#include <cstring>
+#include <string_view>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+constexpr const std::array<int, 2> kStdFds = {STDOUT_FILENO, STDERR_FILENO};
+/// Most bytes moved by one read, when the target does not take splice
+constexpr const size_t kChunkSize = 65536;
+/// How often the pipes are looked at per flush interval
+constexpr const int kChecksPerInterval = 4;
+
+/// Set by the SIGTERM handler, which wakes the relay through StopFd
+volatile std::sig_atomic_t Terminated = 0;
+int TerminateFd = -1;
+struct sigaction SavedTerminate;
+
+void terminate(int) noexcept {
+  const int Err = errno;
+  Terminated = 1;
+  const uint64_t One = 1;
+  write(TerminateFd, &One, sizeof(One));
+  errno = Err;
+}
+
+/// Bytes waiting in the pipe Fd.
+size_t pending(int Fd) noexcept {
+  int Pending = 0;
+  if (ioctl(Fd, FIONREAD, &Pending) < 0 || Pending < 0) {
+    return 0;
+  }
+  return static_cast<size_t>(Pending);
+}
+
+/// Wait until Fd takes more data, for inherited fds set to non-blocking.
+bool waitWritable(int Fd) noexcept {
+  pollfd PollFd = {Fd, POLLOUT, 0};
+  while (poll(&PollFd, 1, -1) < 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+cxx20::expected<void, int>
+OutputStage::start(uint32_t BufferSize,
+                   std::chrono::milliseconds FlushInterval) noexcept {
+  this->FlushInterval = FlushInterval;
+
+  bool Started = false;
+  std::array<int, 2> GuestFds = {-1, -1};
+  BOOST_SCOPE_EXIT_ALL(&) {
+    for (const int Fd : GuestFds) {
+      if (Fd >= 0) {
+        close(Fd);
+      }
+    }
+    if (!Started) {
+      closeAll();
+    }
+  };
+  for (size_t I = 0; I < Streams.size(); ++I) {
+    auto &S = Streams[I];
+    std::array<int, 2> Guest;
+    if ((S.Target = fcntl(kStdFds[I], F_DUPFD_CLOEXEC, 3)) < 0 ||
+        pipe2(Guest.data(), O_CLOEXEC) < 0) {
+      spdlog::error("output stage pipe failed: {}"sv, std::strerror(errno));
+      return cxx20::unexpected(errno);
+    }
+    S.In = Guest[0];
+    GuestFds[I] = Guest[1];
+    // The guest blocks on a full pipe, so it holds a batch and room for the
+    // writes until the next look. Pipes hold 64KiB by default, and
+    // unprivileged callers are capped at /proc/sys/fs/pipe-max-size, so
+    // failures only shrink the batches.
+    const uint64_t PipeSize = static_cast<uint64_t>(BufferSize) * 2;
+    fcntl(Guest[1], F_SETPIPE_SZ,
+          static_cast<int>(std::min<uint64_t>(PipeSize, INT32_MAX)));
+    const int Capacity = fcntl(Guest[1], F_GETPIPE_SZ);
+    S.Threshold = std::min<size_t>(BufferSize,
+                                   Capacity > 0 ? Capacity / 2 : BufferSize);
+  }
+  if ((StopFd = eventfd(0, EFD_CLOEXEC)) < 0) {
+    spdlog::error("output stage eventfd failed: {}"sv, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+
+  // SIGTERM would end the process with the batches unwritten. The relay
+  // flushes them and ends the process with the signal itself.
+  struct sigaction Action = {};
+  Action.sa_handler = terminate;
+  sigemptyset(&Action.sa_mask);
+  Action.sa_flags = SA_RESTART;
+  if (sigaction(SIGTERM, nullptr, &SavedTerminate) == 0 &&
+      SavedTerminate.sa_handler == SIG_DFL) {
+    TerminateFd = StopFd;
+    sigaction(SIGTERM, &Action, nullptr);
+  }
+
+  // Guest processes started through wasmedge_process inherit the stage too
+  for (size_t I = 0; I < Streams.size(); ++I) {
+    dup2(GuestFds[I], kStdFds[I]);
+  }
+  Thread = std::thread(&OutputStage::relay, this);
+  Started = true;
+  return {};
+}
+
+void OutputStage::stop() noexcept {
+  if (!Thread.joinable()) {
+    return;
+  }
+  // Everything the guest wrote is in the guest pipes by now, and nothing
+  // written from here on goes through them
+  for (size_t I = 0; I < Streams.size(); ++I) {
+    dup2(Streams[I].Target, kStdFds[I]);
+  }
+  const uint64_t One = 1;
+  while (write(StopFd, &One, sizeof(One)) < 0 && errno == EINTR) {
+  }
+  Thread.join();
+  if (TerminateFd >= 0) {
+    sigaction(SIGTERM, &SavedTerminate, nullptr);
+    TerminateFd = -1;
+  }
+  closeAll();
+  // A SIGTERM that came after the last look of the relay
+  if (Terminated) {
+    raise(SIGTERM);
+  }
+}
+
+void OutputStage::relay() noexcept {
+  const int Tick = static_cast<int>(
+      std::max<int64_t>(FlushInterval.count() / kChecksPerInterval, 1));
+  // Time until the next look, shorter than Tick while the guest fills
+  // batches between looks
+  int Wait = Tick;
+  while (true) {
+    // Only the stop and the timer wake the relay, not the writes of the guest
+    pollfd PollFd = {StopFd, POLLIN, 0};
+    const int Ret = poll(&PollFd, 1, Wait);
+    if (Ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (Ret < 0) {
+      spdlog::error("output stage poll failed: {}"sv, std::strerror(errno));
+    }
+    const bool Stopping = Ret != 0;
+
+    const auto Now = std::chrono::steady_clock::now();
+    bool Filled = false;
+    for (auto &S : Streams) {
+      const size_t Pending = pending(S.In);
+      if (Pending == 0) {
+        S.Size = 0;
+        continue;
+      }
+      if (S.Size == 0) {
+        S.Since = Now;
+      }
+      S.Size = Pending;
+      Filled = Filled || S.Size >= S.Threshold;
+      if (Stopping || S.Size >= S.Threshold ||
+          Now - S.Since >= FlushInterval) {
+        flush(S);
+        // A fast guest refills the pipe while it is flushed, drain it again
+        // rather than leave the guest blocked on it until the next look
+        while (!Stopping && (S.Size = pending(S.In)) >= S.Threshold) {
+          flush(S);
+        }
+        S.Size = 0;
+      }
+      // Writers the guest started may still have the pipe open
+      while (Stopping && (S.Size = pending(S.In)) > 0) {
+        flush(S);
+      }
+    }
+    // Look twice as often while a batch filled up since the last look, so
+    // the guest does not block on a full pipe, and back off as it slows down
+    Wait = Filled ? std::max(Wait / 2, 1) : std::min(Wait * 2, Tick);
+    if (Stopping) {
+      if (Terminated) {
+        signal(SIGTERM, SIG_DFL);
+        raise(SIGTERM);
+      }
+      return;
+    }
+  }
+}
+
+void OutputStage::flush(Stream &S) noexcept {
+  while (S.Size > 0) {
+    ssize_t Moved;
+    if (S.Splice) {
+      Moved = splice(S.In, nullptr, S.Target, nullptr, S.Size, SPLICE_F_MOVE);
+    } else {
+      char Buffer[kChunkSize];
+      Moved = read(S.In, Buffer, std::min(S.Size, sizeof(Buffer)));
+      for (ssize_t Written = 0; Moved > 0 && Written < Moved;) {
+        if (const ssize_t Ret =
+                write(S.Target, Buffer + Written, Moved - Written);
+            Ret >= 0) {
+          Written += Ret;
+        } else if (errno != EINTR &&
+                   (errno != EAGAIN || !waitWritable(S.Target))) {
+          // The bytes are out of the guest pipe, so count them as flushed
+          spdlog::error("output stage write failed: {}"sv,
+                        std::strerror(errno));
+          break;
+        }
+      }
+    }
+    if (Moved > 0) {
+      S.Size -= Moved;
+      continue;
+    }
+    if (Moved < 0 &&
+        (errno == EINTR || (errno == EAGAIN && waitWritable(S.Target)))) {
+      continue;
+    }
+    if (Moved < 0 && S.Splice && errno == EINVAL) {
+      S.Splice = false;
+      continue;
+    }
+    // The reader is gone, drop the output rather than stall the guest
+    spdlog::error("output stage flush failed: {}"sv, std::strerror(errno));
+    char Buffer[kChunkSize];
+    while (S.Size > 0) {
+      const ssize_t Ret = read(S.In, Buffer, std::min(S.Size, sizeof(Buffer)));
+      if (Ret <= 0) {
+        break;
+      }
+      S.Size -= Ret;
+    }
+    S.Size = 0;
+    return;
+  }
+}
+
+void OutputStage::closeAll() noexcept {
+  for (auto &S : Streams) {
+    for (int *Fd : {&S.Target, &S.In}) {
+      if (*Fd >= 0) {
+        close(*Fd);
+        *Fd = -1;
+      }
+    }
+    S.Size = 0;
+  }
+  if (StopFd >= 0) {
+    close(StopFd);
+    StopFd = -1;
+  }
+}
+
+} // namespace RUNW
@@ -0,0 +1,250 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "pidfd.h"
+#include "unixsocket.h"
+#include <array>
+#include <boost/scope_exit.hpp>
+#include <common/log.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if !defined(SYS_pidfd_send_signal)
+#define SYS_pidfd_send_signal 424
+#endif
+#if !defined(SYS_pidfd_open)
+#define SYS_pidfd_open 434
+#endif
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+const std::string_view kSocketName = "pidfd.sock"sv;
+/// Holder program, installed next to runw-vm
+const std::string_view kHolderName = "runw-pidfd"sv;
+
+/// Leave only the given fds open, so the holder does not keep the stdio and
+/// fifos of the container alive.
+void closeOtherFds(int Fd1, int Fd2, int Fd3) noexcept {
+  if (const int Null = ::open("/dev/null", O_RDWR); Null >= 0) {
+    dup2(Null, STDIN_FILENO);
+    dup2(Null, STDOUT_FILENO);
+    dup2(Null, STDERR_FILENO);
+    if (Null > STDERR_FILENO) {
+      close(Null);
+    }
+  }
+  std::vector<int> Fds;
+  std::error_code ErrCode;
+  for (const auto &Entry :
+       std::filesystem::directory_iterator("/proc/self/fd", ErrCode)) {
+    const auto Name = Entry.path().filename().native();
+    if (const int Fd = std::atoi(Name.c_str());
+        Fd > STDERR_FILENO && Fd != Fd1 && Fd != Fd2 && Fd != Fd3) {
+      Fds.push_back(Fd);
+    }
+  }
+  for (const int Fd : Fds) {
+    close(Fd);
+  }
+}
+
+void sendFd(int Conn, int Fd) noexcept {
+  char Status = '0';
+  alignas(cmsghdr) char Control[CMSG_SPACE(sizeof(int))] = {};
+  iovec Iov = {&Status, sizeof(Status)};
+  msghdr Msg = {};
+  Msg.msg_iov = &Iov;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+  cmsghdr *Cmsg = CMSG_FIRSTHDR(&Msg);
+  Cmsg->cmsg_level = SOL_SOCKET;
+  Cmsg->cmsg_type = SCM_RIGHTS;
+  Cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(Cmsg), &Fd, sizeof(int));
+  while (sendmsg(Conn, &Msg, MSG_NOSIGNAL) < 0 && errno == EINTR) {
+  }
+}
+
+} // namespace
+
+cxx20::expected<int, int> PidFd::open(pid_t Pid) noexcept {
+  const int Fd = static_cast<int>(syscall(SYS_pidfd_open, Pid, 0));
+  if (Fd < 0) {
+    spdlog::info("pidfd_open {} failed: {}"sv, Pid, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+  fcntl(Fd, F_SETFD, FD_CLOEXEC);
+  return Fd;
+}
+
+cxx20::expected<void, int> PidFd::sendSignal(int Fd, int Signal) noexcept {
+  if (syscall(SYS_pidfd_send_signal, Fd, Signal, nullptr, 0) < 0) {
+    spdlog::error("pidfd_send_signal failed: {}"sv, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+  return {};
+}
+
+cxx20::expected<void, int>
+PidFd::hold(int Fd, const std::filesystem::path &ContainerRoot) noexcept {
+  const auto Path = ContainerRoot / kSocketName;
+  // Listen before forking, so the socket exists once create returns
+  int ListenFd;
+  if (auto Res = UnixSocket::listen(Path, SOCK_STREAM)) {
+    ListenFd = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&ListenFd) { close(ListenFd); };
+
+  // The holder is a small program of its own, not a copy of the caller with
+  // the VM and everything else it had mapped
+  std::error_code ErrCode;
+  auto Holder = std::filesystem::read_symlink("/proc/self/exe"sv, ErrCode);
+  if (ErrCode) {
+    spdlog::error("resolve /proc/self/exe failed: {}"sv, ErrCode.message());
+    unlink(Path.c_str());
+    return cxx20::unexpected(ErrCode.value());
+  }
+  Holder.replace_filename(kHolderName);
+  const auto FdArg = std::to_string(Fd);
+  const auto ListenFdArg = std::to_string(ListenFd);
+  const char *Argv[] = {kHolderName.data(), FdArg.c_str(),
+                        ListenFdArg.c_str(), nullptr};
+
+  // Closed by a successful exec, or carries its errno back
+  std::array<int, 2> ExecPipe;
+  if (pipe2(ExecPipe.data(), O_CLOEXEC) < 0) {
+    spdlog::error("pipe failed: {}"sv, std::strerror(errno));
+    unlink(Path.c_str());
+    return cxx20::unexpected(errno);
+  }
+  const pid_t Pid = fork();
+  if (Pid < 0) {
+    const int Err = errno;
+    spdlog::error("fork failed: {}"sv, std::strerror(Err));
+    close(ExecPipe[0]);
+    close(ExecPipe[1]);
+    unlink(Path.c_str());
+    return cxx20::unexpected(Err);
+  }
+  if (Pid == 0) {
+    closeOtherFds(Fd, ListenFd, ExecPipe[1]);
+    fcntl(Fd, F_SETFD, 0);
+    fcntl(ListenFd, F_SETFD, 0);
+    execv(Holder.c_str(), const_cast<char *const *>(Argv));
+    const int Err = errno;
+    while (write(ExecPipe[1], &Err, sizeof(Err)) < 0 && errno == EINTR) {
+    }
+    _exit(EXIT_FAILURE);
+  }
+
+  close(ExecPipe[1]);
+  int Err = 0;
+  ssize_t Size;
+  do {
+    Size = read(ExecPipe[0], &Err, sizeof(Err));
+  } while (Size < 0 && errno == EINTR);
+  close(ExecPipe[0]);
+  if (Size > 0) {
+    spdlog::error("exec {} failed: {}"sv, Holder, std::strerror(Err));
+    unlink(Path.c_str());
+    return cxx20::unexpected(Err);
+  }
+  return {};
+}
+
+void PidFd::serve(int Fd, int ListenFd) noexcept {
+  std::array<pollfd, 2> PollFds = {
+      pollfd{Fd, POLLIN, 0},
+      pollfd{ListenFd, POLLIN, 0},
+  };
+  while (true) {
+    if (poll(PollFds.data(), PollFds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (PollFds[0].revents) {
+      break;
+    }
+    if (PollFds[1].revents & POLLIN) {
+      // The pidfd lets whoever holds it signal the container
+      if (const int Conn = accept4(ListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+          Conn >= 0) {
+        if (UnixSocket::trustedPeer(Conn)) {
+          sendFd(Conn, Fd);
+        }
+        close(Conn);
+      }
+    }
+  }
+  // Keep the socket, so connects fail with ECONNREFUSED from now on
+}
+
+cxx20::expected<void, int>
+PidFd::track(pid_t Pid, const std::filesystem::path &ContainerRoot) noexcept {
+  const auto Fd = open(Pid);
+  if (!Fd) {
+    return cxx20::unexpected(Fd.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&Fd) { close(*Fd); };
+  return hold(*Fd, ContainerRoot);
+}
+
+cxx20::expected<int, int>
+PidFd::connect(const std::filesystem::path &ContainerRoot) noexcept {
+  int Conn;
+  if (auto Res = UnixSocket::connect(ContainerRoot / kSocketName,
+                                     SOCK_STREAM)) {
+    Conn = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&Conn) { close(Conn); };
+
+  char Status;
+  alignas(cmsghdr) char Control[CMSG_SPACE(sizeof(int))];
+  iovec Iov = {&Status, sizeof(Status)};
+  msghdr Msg = {};
+  Msg.msg_iov = &Iov;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+  ssize_t Size;
+  do {
+    Size = recvmsg(Conn, &Msg, MSG_CMSG_CLOEXEC);
+  } while (Size < 0 && errno == EINTR);
+  if (Size != sizeof(Status)) {
+    // The holder exits with the container, dropping pending connections
+    return cxx20::unexpected(Size < 0 ? errno : ECONNREFUSED);
+  }
+  for (cmsghdr *Cmsg = CMSG_FIRSTHDR(&Msg); Cmsg != nullptr;
+       Cmsg = CMSG_NXTHDR(&Msg, Cmsg)) {
+    if (Cmsg->cmsg_level == SOL_SOCKET && Cmsg->cmsg_type == SCM_RIGHTS &&
+        Cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+      int Fd;
+      std::memcpy(&Fd, CMSG_DATA(Cmsg), sizeof(int));
+      return Fd;
+    }
+  }
+  return cxx20::unexpected(EPROTO);
+}
+
+} // namespace RUNW
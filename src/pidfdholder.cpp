@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "pidfd.h"
+#include <cstdlib>
+
+/// Holder of the pidfd of a container, started by PidFd::hold with the pidfd
+/// and the listening socket it serves it on.
+int main(int Argc, const char *Argv[]) {
+  if (Argc != 3) {
+    return EXIT_FAILURE;
+  }
+  RUNW::PidFd::serve(std::atoi(Argv[1]), std::atoi(Argv[2]));
+  return EXIT_SUCCESS;
+}
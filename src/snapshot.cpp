@@ -0,0 +1,441 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "snapshot.h"
+#include <algorithm>
+#include <boost/scope_exit.hpp>
+#include <common/log.h>
+#include <common/value.h>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <runtime/storemgr.h>
+#include <vector>
+#include <vm/vm.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+const std::string_view kSnapshotSuffix = ".snapshot"sv;
+const std::string_view kMagic = "RUNWSNP2"sv;
+
+// Memory contents start at this file offset alignment, so they can be mapped
+// on any host page size.
+constexpr const uint64_t kDataAlignment = UINT64_C(65536);
+
+// Record tags
+const uint8_t kMemoryTag = 'M';
+const uint8_t kGlobalTag = 'G';
+const uint8_t kEndTag = 'E';
+
+using WasmEdge::Runtime::Instance::GlobalInstance;
+using WasmEdge::Runtime::Instance::MemoryInstance;
+
+template <typename T> void writeValue(std::ostream &Stream, T Value) {
+  Stream.write(reinterpret_cast<const char *>(&Value), sizeof(Value));
+}
+
+class Reader {
+public:
+  Reader(const uint8_t *Data, size_t Size) noexcept : Data(Data), Size(Size) {}
+
+  template <typename T> bool read(T &Value) noexcept {
+    if (Size - Offset < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&Value, Data + Offset, sizeof(T));
+    Offset += sizeof(T);
+    return true;
+  }
+
+  bool align(uint64_t Alignment) noexcept {
+    const auto Aligned = (Offset + Alignment - 1) & ~(Alignment - 1);
+    if (Aligned > Size) {
+      return false;
+    }
+    Offset = Aligned;
+    return true;
+  }
+
+  uint64_t offset() const noexcept { return Offset; }
+
+  const uint8_t *take(uint64_t Length) noexcept {
+    if (Size - Offset < Length) {
+      return nullptr;
+    }
+    const uint8_t *Result = Data + Offset;
+    Offset += Length;
+    return Result;
+  }
+
+private:
+  const uint8_t *Data;
+  size_t Size;
+  size_t Offset = 0;
+};
+
+template <typename T> uint64_t loadBits(GlobalInstance &Global) noexcept {
+  const T Value = WasmEdge::retrieveValue<T>(Global.getValue());
+  uint64_t Bits = 0;
+  std::memcpy(&Bits, &Value, sizeof(Value));
+  return Bits;
+}
+
+template <typename T>
+void storeBits(GlobalInstance &Global, uint64_t Bits) noexcept {
+  T Value;
+  std::memcpy(&Value, &Bits, sizeof(Value));
+  WasmEdge::retrieveValue<T>(Global.getValue()) = Value;
+}
+
+/// Place Length bytes of Fd at Offset into memory at Data. Whole pages are
+/// mapped copy-on-write, so replicas share them in the page cache until they
+/// write to them.
+void placeMemory(WasmEdge::Byte *Data, const uint8_t *Bytes, uint64_t Length,
+                 int Fd, uint64_t Offset) noexcept {
+  const auto PageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+  uint64_t Mapped = 0;
+  if (reinterpret_cast<uintptr_t>(Data) % PageSize == 0 &&
+      Offset % PageSize == 0) {
+    Mapped = Length & ~(PageSize - 1);
+    if (Mapped > 0 &&
+        mmap(Data, Mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, Fd,
+             Offset) == MAP_FAILED) {
+      spdlog::info("map snapshot failed, copy instead: {}"sv,
+                   std::strerror(errno));
+      Mapped = 0;
+    }
+  }
+  std::memcpy(Data + Mapped, Bytes + Mapped, Length - Mapped);
+}
+
+/// Zero [Begin, End). Whole pages are dropped instead of written, so the
+/// parts of the memory the snapshot does not cover stay unbacked.
+void clearMemory(WasmEdge::Byte *Begin, WasmEdge::Byte *End) noexcept {
+  const auto PageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  const auto First =
+      (reinterpret_cast<uintptr_t>(Begin) + PageSize - 1) & ~(PageSize - 1);
+  const auto Last = reinterpret_cast<uintptr_t>(End) & ~(PageSize - 1);
+  if (First < Last && madvise(reinterpret_cast<void *>(First), Last - First,
+                              MADV_DONTNEED) == 0) {
+    std::memset(Begin, 0, First - reinterpret_cast<uintptr_t>(Begin));
+    std::memset(reinterpret_cast<void *>(Last), 0,
+                reinterpret_cast<uintptr_t>(End) - Last);
+  } else {
+    std::memset(Begin, 0, End - Begin);
+  }
+}
+
+} // namespace
+
+std::filesystem::path Snapshot::path(const std::filesystem::path &SoPath) {
+  auto Path = SoPath;
+  Path.concat(kSnapshotSuffix);
+  return Path;
+}
+
+cxx20::expected<void, int>
+Snapshot::capture(WasmEdge::VM::VM &VM, std::string_view Init,
+                  const std::filesystem::path &SoPath) noexcept {
+  if (Init.empty()) {
+    spdlog::info("snapshot the instantiated module"sv);
+  } else if (auto Res = VM.execute(Init); !Res) {
+    spdlog::error("execute {} failed: {}"sv, Init,
+                  WasmEdge::ErrCodeStr[Res.error()]);
+    return cxx20::unexpected(EINVAL);
+  }
+
+  auto &StoreMgr = VM.getStoreManager();
+  WasmEdge::Runtime::Instance::ModuleInstance *Module;
+  if (auto Res = StoreMgr.getActiveModule()) {
+    Module = *Res;
+  } else {
+    spdlog::error("no instantiated module"sv);
+    return cxx20::unexpected(EINVAL);
+  }
+
+  // Write next to the artifact and rename into place, like the artifact
+  auto TempPath = SoPath;
+  TempPath.replace_extension(
+      std::filesystem::u8path(".tmp"s + std::to_string(getpid()) + ".so"s));
+  TempPath.concat(kSnapshotSuffix);
+  std::ofstream Stream(TempPath, std::ios::binary | std::ios::trunc);
+  if (!Stream) {
+    spdlog::error("create {} failed"sv, TempPath);
+    return cxx20::unexpected(EIO);
+  }
+  auto &&Fail = [&TempPath](int Err) {
+    std::error_code ErrCode;
+    std::filesystem::remove(TempPath, ErrCode);
+    return cxx20::unexpected(Err);
+  };
+
+  Stream.write(kMagic.data(), kMagic.size());
+  writeValue(Stream, static_cast<uint32_t>(Init.size()));
+  Stream.write(Init.data(), Init.size());
+
+  for (uint32_t Index = 0;; ++Index) {
+    auto Addr = Module->getMemAddr(Index);
+    if (!Addr) {
+      break;
+    }
+    MemoryInstance *Memory;
+    if (auto Res = StoreMgr.getMemory(*Addr)) {
+      Memory = *Res;
+    } else {
+      break;
+    }
+    const uint32_t Pages = Memory->getDataPageSize();
+    const WasmEdge::Byte *Data = Memory->getDataPtr();
+    // Trailing zeros are restored by clearing, not stored
+    uint64_t Length = uint64_t(Pages) * MemoryInstance::kPageSize;
+    while (Length > 0 && Data[Length - 1] == 0) {
+      --Length;
+    }
+    writeValue(Stream, kMemoryTag);
+    writeValue(Stream, Index);
+    writeValue(Stream, Pages);
+    writeValue(Stream, Length);
+    const auto Position = static_cast<uint64_t>(Stream.tellp());
+    const auto Padding = (kDataAlignment - Position % kDataAlignment) %
+                         kDataAlignment;
+    std::fill_n(std::ostreambuf_iterator<char>(Stream), Padding, '\0');
+    Stream.write(reinterpret_cast<const char *>(Data), Length);
+    spdlog::info("snapshot memory {}: {} pages, {} bytes"sv, Index, Pages,
+                 Length);
+  }
+
+  for (uint32_t Index = 0;; ++Index) {
+    auto Addr = Module->getGlobalAddr(Index);
+    if (!Addr) {
+      break;
+    }
+    GlobalInstance *Global;
+    if (auto Res = StoreMgr.getGlobal(*Addr)) {
+      Global = *Res;
+    } else {
+      break;
+    }
+    if (Global->getValMut() != WasmEdge::ValMut::Var) {
+      continue;
+    }
+    uint64_t Bits;
+    switch (Global->getValType()) {
+    case WasmEdge::ValType::I32:
+      Bits = loadBits<uint32_t>(*Global);
+      break;
+    case WasmEdge::ValType::I64:
+      Bits = loadBits<uint64_t>(*Global);
+      break;
+    case WasmEdge::ValType::F32:
+      Bits = loadBits<float>(*Global);
+      break;
+    case WasmEdge::ValType::F64:
+      Bits = loadBits<double>(*Global);
+      break;
+    default:
+      spdlog::error("global {} has a type snapshots do not support"sv, Index);
+      return Fail(ENOTSUP);
+    }
+    writeValue(Stream, kGlobalTag);
+    writeValue(Stream, Index);
+    writeValue(Stream, static_cast<uint8_t>(Global->getValType()));
+    writeValue(Stream, Bits);
+  }
+  writeValue(Stream, kEndTag);
+
+  Stream.close();
+  if (!Stream) {
+    spdlog::error("write {} failed"sv, TempPath);
+    return Fail(EIO);
+  }
+  const auto Path = path(SoPath);
+  if (std::error_code ErrCode;
+      std::filesystem::rename(TempPath, Path, ErrCode), ErrCode) {
+    spdlog::error("publish {} failed: {}"sv, Path, ErrCode.message());
+    return Fail(ErrCode.value());
+  }
+  return {};
+}
+
+cxx20::expected<void, int>
+Snapshot::restore(WasmEdge::VM::VM &VM, std::string_view Init,
+                  const std::filesystem::path &SoPath) noexcept {
+  const auto Path = path(SoPath);
+  const int Fd = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (Fd < 0) {
+    return cxx20::unexpected(errno);
+  }
+  BOOST_SCOPE_EXIT_ALL(&Fd) { close(Fd); };
+
+  struct stat Stat;
+  if (fstat(Fd, &Stat) < 0) {
+    return cxx20::unexpected(errno);
+  }
+  if (static_cast<size_t>(Stat.st_size) < kMagic.size()) {
+    spdlog::error("corrupt snapshot {}"sv, Path);
+    return cxx20::unexpected(EINVAL);
+  }
+  void *Map = mmap(nullptr, Stat.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+  if (Map == MAP_FAILED) {
+    spdlog::error("mmap {} failed: {}"sv, Path, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+  BOOST_SCOPE_EXIT_ALL(&Map, &Stat) { munmap(Map, Stat.st_size); };
+
+  Reader Reader(static_cast<const uint8_t *>(Map), Stat.st_size);
+  auto &&Corrupt = [&Path]() {
+    spdlog::error("corrupt snapshot {}"sv, Path);
+    return cxx20::unexpected(EINVAL);
+  };
+  if (const auto *Magic = Reader.take(kMagic.size());
+      std::memcmp(Magic, kMagic.data(), kMagic.size()) != 0) {
+    spdlog::info("snapshot {} has an old format"sv, Path);
+    return cxx20::unexpected(ESTALE);
+  }
+  uint32_t InitSize;
+  if (!Reader.read(InitSize)) {
+    return Corrupt();
+  }
+  if (const auto *Name = Reader.take(InitSize);
+      !Name || std::string_view(reinterpret_cast<const char *>(Name),
+                                InitSize) != Init) {
+    spdlog::info("snapshot {} was taken with another init export"sv, Path);
+    return cxx20::unexpected(ESTALE);
+  }
+
+  auto &StoreMgr = VM.getStoreManager();
+  WasmEdge::Runtime::Instance::ModuleInstance *Module;
+  if (auto Res = StoreMgr.getActiveModule()) {
+    Module = *Res;
+  } else {
+    spdlog::error("no instantiated module"sv);
+    return cxx20::unexpected(EINVAL);
+  }
+
+  // Check every record against the instance before changing anything, so a
+  // failed restore leaves the instance as instantiation left it
+  struct MemoryRecord {
+    MemoryInstance *Memory;
+    uint32_t Pages;
+    uint64_t Length;
+    const uint8_t *Bytes;
+    uint64_t Offset;
+  };
+  struct GlobalRecord {
+    GlobalInstance *Global;
+    uint64_t Bits;
+  };
+  std::vector<MemoryRecord> Memories;
+  std::vector<GlobalRecord> Globals;
+  while (true) {
+    uint8_t Tag;
+    uint32_t Index;
+    if (!Reader.read(Tag)) {
+      return Corrupt();
+    }
+    if (Tag == kEndTag) {
+      break;
+    }
+    if (!Reader.read(Index)) {
+      return Corrupt();
+    }
+
+    if (Tag == kMemoryTag) {
+      MemoryRecord Record;
+      if (!Reader.read(Record.Pages) || !Reader.read(Record.Length) ||
+          Record.Length > uint64_t(Record.Pages) * MemoryInstance::kPageSize ||
+          !Reader.align(kDataAlignment) ||
+          (Record.Offset = Reader.offset(),
+           !(Record.Bytes = Reader.take(Record.Length)))) {
+        return Corrupt();
+      }
+      if (auto Addr = Module->getMemAddr(Index); !Addr) {
+        return Corrupt();
+      } else if (auto Res = StoreMgr.getMemory(*Addr)) {
+        Record.Memory = *Res;
+      } else {
+        return Corrupt();
+      }
+      if (Record.Memory->getDataPageSize() > Record.Pages) {
+        return Corrupt();
+      }
+      Memories.push_back(Record);
+    } else if (Tag == kGlobalTag) {
+      GlobalRecord Record;
+      uint8_t Type;
+      if (!Reader.read(Type) || !Reader.read(Record.Bits)) {
+        return Corrupt();
+      }
+      if (auto Addr = Module->getGlobalAddr(Index); !Addr) {
+        return Corrupt();
+      } else if (auto Res = StoreMgr.getGlobal(*Addr)) {
+        Record.Global = *Res;
+      } else {
+        return Corrupt();
+      }
+      if (static_cast<uint8_t>(Record.Global->getValType()) != Type) {
+        return Corrupt();
+      }
+      switch (Record.Global->getValType()) {
+      case WasmEdge::ValType::I32:
+      case WasmEdge::ValType::I64:
+      case WasmEdge::ValType::F32:
+      case WasmEdge::ValType::F64:
+        break;
+      default:
+        return Corrupt();
+      }
+      Globals.push_back(Record);
+    } else {
+      return Corrupt();
+    }
+  }
+
+  // Growing is the only step left that can fail, so it goes first. Memories
+  // grown before a failure stay grown, which is why ENOMEM is fatal.
+  for (const auto &Record : Memories) {
+    const uint32_t Current = Record.Memory->getDataPageSize();
+    if (Current < Record.Pages &&
+        !Record.Memory->growPage(Record.Pages - Current)) {
+      spdlog::error("grow memory to {} pages failed"sv, Record.Pages);
+      return cxx20::unexpected(ENOMEM);
+    }
+  }
+  for (const auto &Record : Memories) {
+    WasmEdge::Byte *Data = Record.Memory->getDataPtr();
+    placeMemory(Data, Record.Bytes, Record.Length, Fd, Record.Offset);
+    clearMemory(Data + Record.Length,
+                Data + uint64_t(Record.Pages) * MemoryInstance::kPageSize);
+  }
+  for (const auto &Record : Globals) {
+    switch (Record.Global->getValType()) {
+    case WasmEdge::ValType::I32:
+      storeBits<uint32_t>(*Record.Global, Record.Bits);
+      break;
+    case WasmEdge::ValType::I64:
+      storeBits<uint64_t>(*Record.Global, Record.Bits);
+      break;
+    case WasmEdge::ValType::F32:
+      storeBits<float>(*Record.Global, Record.Bits);
+      break;
+    case WasmEdge::ValType::F64:
+      storeBits<double>(*Record.Global, Record.Bits);
+      break;
+    default:
+      break;
+    }
+  }
+  return {};
+}
+
+} // namespace RUNW
@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "unixsocket.h"
+#include <common/log.h>
+#include <cstring>
+#include <string_view>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+cxx20::expected<sockaddr_un, int>
+makeAddress(const std::filesystem::path &Path) noexcept {
+  sockaddr_un Addr = {};
+  const auto &Native = Path.native();
+  if (Native.size() >= sizeof(Addr.sun_path)) {
+    spdlog::error("socket path too long: {}"sv, Path);
+    return cxx20::unexpected(ENAMETOOLONG);
+  }
+  std::copy(Native.begin(), Native.end(), Addr.sun_path);
+  Addr.sun_family = AF_UNIX;
+  return Addr;
+}
+
+} // namespace
+
+cxx20::expected<int, int>
+UnixSocket::listen(const std::filesystem::path &Path, int Type) noexcept {
+  sockaddr_un Addr;
+  if (auto Res = makeAddress(Path)) {
+    Addr = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+
+  const int Fd = socket(AF_UNIX, Type | SOCK_CLOEXEC, 0);
+  if (Fd < 0) {
+    spdlog::error("socket failed: {}"sv, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+  unlink(Path.c_str());
+  // The socket must not be connectable by others before the chmod
+  const mode_t Umask = umask(0077);
+  const int Bound = bind(Fd, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr));
+  umask(Umask);
+  if (Bound < 0 || chmod(Path.c_str(), 0600) < 0 ||
+      ::listen(Fd, SOMAXCONN) < 0) {
+    const int Err = errno;
+    spdlog::error("listen on {} failed: {}"sv, Path, std::strerror(Err));
+    close(Fd);
+    if (Bound == 0) {
+      unlink(Path.c_str());
+    }
+    return cxx20::unexpected(Err);
+  }
+  return Fd;
+}
+
+cxx20::expected<int, int>
+UnixSocket::connect(const std::filesystem::path &Path, int Type) noexcept {
+  sockaddr_un Addr;
+  if (auto Res = makeAddress(Path)) {
+    Addr = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+
+  const int Fd = socket(AF_UNIX, Type | SOCK_CLOEXEC, 0);
+  if (Fd < 0) {
+    return cxx20::unexpected(errno);
+  }
+  if (::connect(Fd, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) < 0) {
+    const int Err = errno;
+    close(Fd);
+    return cxx20::unexpected(Err);
+  }
+  return Fd;
+}
+
+bool UnixSocket::trustedPeer(int Fd) noexcept {
+  ucred Cred;
+  socklen_t Size = sizeof(Cred);
+  if (getsockopt(Fd, SOL_SOCKET, SO_PEERCRED, &Cred, &Size) < 0) {
+    spdlog::error("get peer credentials failed: {}"sv, std::strerror(errno));
+    return false;
+  }
+  if (Cred.uid != 0 && Cred.uid != geteuid()) {
+    spdlog::error("refused request of uid {}"sv, Cred.uid);
+    return false;
+  }
+  return true;
+}
+
+} // namespace RUNW
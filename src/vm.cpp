@@ -0,0 +1,1842 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include "aotcache.h"
+#include "cgroup.h"
+#include "compileserver.h"
+#include "config.h"
+#include "daemon.h"
+#include "defines.h"
+#include "host.h"
+#include "lifecycle.h"
+#include "options.h"
+#include "output.h"
+#include "pidfd.h"
+#include "snapshot.h"
+#include "state.h"
+#include "zygote.h"
+#include <algorithm>
+#include <array>
+#include <aot/compiler.h>
+#include <boost/scope_exit.hpp>
+#include <chrono>
+#include <common/filesystem.h>
+#include <common/log.h>
+#include <cstdlib>
+#include <host/wasi/wasimodule.h>
+#include <host/wasmedge_process/processmodule.h>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <set>
+#include <spdlog/sinks/basic_file_sink.h>
+#include <thread>
+#include <tuple>
+#include <vm/vm.h>
+
+#ifdef RUNW_OS_LINUX
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if !defined(SYS_clone3)
+#define SYS_clone3 435
+#endif
+#if !defined(CLONE_INTO_CGROUP)
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+#endif
+
+namespace {
+
+using namespace std::literals;
+
+constexpr const char *kLogFile = "/tmp/runw.log";
+
+std::filesystem::path getTempFilename(const std::filesystem::path &Prefix) {
+  std::random_device Device;
+  std::default_random_engine Engine(Device());
+  std::uniform_int_distribution<char> Distribution('a', 'z');
+  while (true) {
+    std::array<char, 6> Suffix;
+    for (size_t I = 0; I < 6; ++I) {
+      Suffix[I] = Distribution(Engine);
+    }
+    std::filesystem::path Path = Prefix;
+    Path.concat(std::string_view(Suffix.data(), Suffix.size()));
+    std::ofstream File(Path, std::ios::app);
+    if (File.tellp() == 0) {
+      return Path;
+    }
+  }
+}
+
+template <typename FuncT>
+bool atomicCreateAndWriteFile(const std::filesystem::path &Path, FuncT &&Func) {
+  if (std::error_code ErrCode;
+      std::filesystem::is_regular_file(Path, ErrCode)) {
+    spdlog::error(ErrCode.message());
+    return false;
+  }
+
+  const auto TempFile = getTempFilename(Path);
+
+  if (std::ofstream Stream(TempFile); !Stream) {
+    return false;
+  } else {
+    Func(Stream);
+  }
+
+  if (std::error_code ErrCode;
+      std::filesystem::rename(TempFile, Path, ErrCode), ErrCode) {
+    spdlog::error(ErrCode.message());
+    std::filesystem::remove(TempFile, ErrCode);
+    return false;
+  }
+  return true;
+}
+
+template <typename FuncT>
+bool atomicUpdateFile(const std::filesystem::path &Path, FuncT &&Func) {
+  if (std::error_code ErrCode;
+      !std::filesystem::is_regular_file(Path, ErrCode)) {
+    spdlog::error(ErrCode.message());
+    return false;
+  }
+
+  const auto TempFile = getTempFilename(Path);
+
+  if (std::ofstream Stream(TempFile); !Stream) {
+    return false;
+  } else {
+    Func(Stream);
+  }
+
+  if (std::error_code ErrCode;
+      std::filesystem::rename(TempFile, Path, ErrCode), ErrCode) {
+    spdlog::error(ErrCode.message());
+    std::filesystem::remove(TempFile, ErrCode);
+    return false;
+  }
+  return true;
+}
+
+/// Interruptible AOT code checks the stop token of its VM in loops and calls,
+/// which hosts need to stop killed instances and other modules should not
+/// pay for.
+WasmEdge::Configure createConfigure(bool Interruptible = false) {
+  WasmEdge::Configure Conf;
+  Conf.addProposal(WasmEdge::Proposal::BulkMemoryOperations);
+  Conf.addProposal(WasmEdge::Proposal::ReferenceTypes);
+  Conf.addProposal(WasmEdge::Proposal::SIMD);
+
+  Conf.addHostRegistration(WasmEdge::HostRegistration::Wasi);
+  Conf.addHostRegistration(WasmEdge::HostRegistration::WasmEdge_Process);
+  Conf.getCompilerConfigure().setInterruptible(Interruptible);
+  return Conf;
+}
+
+/// Log the cpu time and peak memory the compile of SoPath used.
+void logCompileUsage(const std::filesystem::path &SoPath) {
+  rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage) < 0) {
+    return;
+  }
+  const auto CpuTime = [](const timeval &Time) {
+    return std::chrono::seconds(Time.tv_sec) +
+           std::chrono::microseconds(Time.tv_usec);
+  };
+  spdlog::info("compile {} used user {}ms, system {}ms, max rss {}KiB"sv,
+               SoPath,
+               std::chrono::duration_cast<std::chrono::milliseconds>(
+                   CpuTime(Usage.ru_utime))
+                   .count(),
+               std::chrono::duration_cast<std::chrono::milliseconds>(
+                   CpuTime(Usage.ru_stime))
+                   .count(),
+               Usage.ru_maxrss);
+}
+
+/// Parse, validate and compile a module, then publish the artifact at SoPath.
+/// Compile in the calling process, which must be dedicated to the compile: it
+/// is moved into a cgroup scope of its own when Limits sets any limit.
+bool compileArtifact(const WasmEdge::Configure &Conf,
+                     WasmEdge::Loader::Loader &Loader,
+                     WasmEdge::Span<const WasmEdge::Byte> Data,
+                     const std::filesystem::path &SoPath,
+                     const RUNW::CGroup::Resources &Limits) {
+  // Without limits the scope costs a round trip to systemd and buys nothing
+  if (Limits.limited()) {
+    if (auto Res = RUNW::CGroup::enterCompile(getpid(), Limits); !Res) {
+      spdlog::info("compile runs outside of its own cgroup"sv);
+    }
+  }
+
+  std::unique_ptr<WasmEdge::AST::Module> Module;
+  if (auto Res = Loader.parseModule(Data)) {
+    Module = std::move(*Res);
+  } else {
+    const auto Err = static_cast<uint32_t>(Res.error());
+    spdlog::error("Load failed. Error code: {}", Err);
+    return false;
+  }
+
+  {
+    WasmEdge::Validator::Validator ValidatorEngine(Conf);
+    if (auto Res = ValidatorEngine.validate(*Module); !Res) {
+      const auto Err = static_cast<uint32_t>(Res.error());
+      spdlog::error("Validate failed. Error code: {}", Err);
+      return false;
+    }
+  }
+
+  // Compile into a private file and rename it into place, so readers never
+  // observe a partially written artifact.
+  auto TempPath = SoPath;
+  TempPath.replace_extension(
+      std::filesystem::u8path(".tmp"s + std::to_string(getpid()) + ".so"s));
+
+  WasmEdge::AOT::Compiler Compiler(Conf);
+  auto Compiled = Compiler.compile(Data, *Module, TempPath);
+  logCompileUsage(SoPath);
+  if (!Compiled) {
+    const auto Err = static_cast<uint32_t>(Compiled.error());
+    spdlog::error("Compile failed. Error code: {}", Err);
+    std::error_code ErrCode;
+    std::filesystem::remove(TempPath, ErrCode);
+    return false;
+  }
+
+  if (auto Res = RUNW::AOTCache::recordVerdict(SoPath, TempPath, Conf); !Res) {
+    std::error_code ErrCode;
+    std::filesystem::remove(TempPath, ErrCode);
+    return false;
+  }
+
+  if (std::error_code ErrCode;
+      std::filesystem::rename(TempPath, SoPath, ErrCode), ErrCode) {
+    spdlog::error("publish {} failed: {}"sv, SoPath, ErrCode.message());
+    std::filesystem::remove(TempPath, ErrCode);
+    return false;
+  }
+  return true;
+}
+
+/// Close every fd above stdio but Keep and the log, so a detached compiler
+/// does not hold the exec fifo, sync pipe or console socket of the container.
+void closeInheritedFds(int Keep) noexcept {
+  std::vector<int> Fds;
+  std::error_code ErrCode;
+  for (const auto &Entry :
+       std::filesystem::directory_iterator("/proc/self/fd", ErrCode)) {
+    const int Fd = std::atoi(Entry.path().filename().c_str());
+    if (Fd <= STDERR_FILENO || Fd == Keep) {
+      continue;
+    }
+    if (std::error_code LinkErr;
+        std::filesystem::read_symlink(Entry.path(), LinkErr) == kLogFile) {
+      continue;
+    }
+    Fds.push_back(Fd);
+  }
+  for (const int Fd : Fds) {
+    close(Fd);
+  }
+}
+
+/// Compile a module into the shared cache. With Wait unset, the compiler runs
+/// detached and publishes the artifact on its own; the cache entry lock is
+/// inherited by the child and held until the artifact is in place.
+bool compileModule(const WasmEdge::Configure &Conf,
+                   WasmEdge::Loader::Loader &Loader,
+                   WasmEdge::Span<const WasmEdge::Byte> Data,
+                   const std::filesystem::path &SoPath, bool Wait,
+                   const RUNW::AOTCache::Lock &Lock,
+                   const RUNW::CGroup::Resources &Limits) {
+  const pid_t CompilerPid = fork();
+  if (WasmEdge::unlikely(CompilerPid < 0)) {
+    spdlog::error("fork failed: {}"sv, std::strerror(errno));
+    return false;
+  }
+  if (CompilerPid == 0) {
+    if (!Wait) {
+      // Do not keep the container's stdio open after it exits
+      if (int Fd = open("/dev/null", O_RDWR); Fd >= 0) {
+        dup2(Fd, STDIN_FILENO);
+        dup2(Fd, STDOUT_FILENO);
+        dup2(Fd, STDERR_FILENO);
+        close(Fd);
+      }
+      closeInheritedFds(Lock.fd());
+    }
+
+    exit(compileArtifact(Conf, Loader, Data, SoPath, Limits) ? EXIT_SUCCESS
+                                                              : EXIT_FAILURE);
+  }
+
+  if (!Wait) {
+    spdlog::info("compiling in background"sv);
+    return true;
+  }
+
+  int Status;
+  do {
+    spdlog::info("wait compiling"sv);
+    if (auto Result = waitpid(CompilerPid, &Status, 0); Result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+    }
+  } while (false);
+  if (WEXITSTATUS(Status) != EXIT_SUCCESS) {
+    spdlog::error("compiling failed, status: {}"sv, Status);
+    return false;
+  }
+  return true;
+}
+
+void initHostModules(WasmEdge::VM::VM &VM, const RUNW::Bundle &Bundle,
+                     const std::filesystem::path &RootPath,
+                     const std::filesystem::path &WasmPath) {
+  WasmEdge::Host::WasiModule *WasiMod =
+      dynamic_cast<WasmEdge::Host::WasiModule *>(
+          VM.getImportModule(WasmEdge::HostRegistration::Wasi));
+  WasmEdge::Host::WasmEdgeProcessModule *ProcMod =
+      dynamic_cast<WasmEdge::Host::WasmEdgeProcessModule *>(
+          VM.getImportModule(WasmEdge::HostRegistration::WasmEdge_Process));
+
+  auto Cwd = RootPath;
+  Cwd += std::filesystem::u8path(Bundle.cwd());
+  std::vector<std::string> Args(Bundle.args().begin(), Bundle.args().end());
+  std::vector<std::string> Envs(Bundle.envs().begin(), Bundle.envs().end());
+  std::vector<std::string> Cmds(Bundle.cmds().begin(), Bundle.cmds().end());
+
+  spdlog::info("cwd: {}"sv, Cwd);
+  spdlog::info("mount: {}"sv, "/:"s + RootPath.u8string());
+  spdlog::info("wasm path: {}"sv, WasmPath.u8string());
+  spdlog::info("args:"sv);
+  for (auto &Arg : Args) {
+    spdlog::info("\targ: {}", Arg);
+  }
+  spdlog::info("envs:"sv);
+  for (auto &Env : Envs) {
+    spdlog::info("\tenv: {}", Env);
+  }
+  spdlog::info("cmds:"sv);
+  for (auto &Cmd : Cmds) {
+    spdlog::info("\tcmd: {}", Cmd);
+  }
+
+  WasiMod->getEnv().init(
+      std::array{"/:"s + RootPath.u8string()}, WasmPath.u8string(),
+      WasmEdge::Span<const std::string>(Args).subspan(1), Envs);
+
+  for (auto &Cmd : Cmds) {
+    ProcMod->getEnv().AllowedCmd.insert(Cmd);
+  }
+  // FIXME: Disable WasmEdge Process Whitelist Protection
+  spdlog::info("Allow all commands to execute"sv);
+  ProcMod->getEnv().AllowedAll = true;
+}
+
+/// Namespaces clone3 can create for the container process. New pid and time
+/// namespaces only apply to children of the process, so they stay with
+/// unshare to keep the container process itself in the namespaces of runw.
+/// The user namespace is entered last, see runContainer.
+constexpr const int kCloneNamespaces = CLONE_NEWNS | CLONE_NEWUTS |
+                                       CLONE_NEWIPC | CLONE_NEWNET
+#if defined(CLONE_NEWCGROUP)
+                                       | CLONE_NEWCGROUP
+#endif
+    ;
+
+/// struct clone_args as of Linux 5.7, which added CLONE_INTO_CGROUP.
+struct CloneArgs {
+  uint64_t Flags;
+  uint64_t PidFd;
+  uint64_t ChildTid;
+  uint64_t ParentTid;
+  uint64_t ExitSignal;
+  uint64_t Stack;
+  uint64_t StackSize;
+  uint64_t Tls;
+  uint64_t SetTid;
+  uint64_t SetTidSize;
+  uint64_t CGroup;
+};
+
+/// Fork the container process with clone3, created in the namespaces of
+/// Flags and, when CGroupFd is valid, in that cgroup.
+pid_t spawnContainer(int CGroupFd, int Flags) noexcept {
+  CloneArgs Args = {};
+  Args.Flags = static_cast<uint64_t>(Flags);
+  if (CGroupFd >= 0) {
+    Args.Flags |= CLONE_INTO_CGROUP;
+    Args.CGroup = static_cast<uint64_t>(CGroupFd);
+  }
+  Args.ExitSignal = SIGCHLD;
+  return static_cast<pid_t>(syscall(SYS_clone3, &Args, sizeof(Args)));
+}
+
+/// Namespaces of the container, as flags of the namespaces to create and
+/// paths of the namespaces to join.
+void collectNamespaces(const RUNW::Bundle &Bundle, int &NewFlags,
+                       std::vector<std::pair<std::string, int>> &JoinPaths) {
+  auto &&AddFlag = [&NewFlags, &JoinPaths](const int Flag,
+                                           const std::string &Path) {
+    if (Path.empty()) {
+      NewFlags |= Flag;
+    } else {
+      JoinPaths.emplace_back(Path, Flag);
+    }
+  };
+  for (const auto &Desc : Bundle.linuxNamespaces()) {
+    switch (Desc.Type.front()) {
+#if defined(CLONE_NEWCGROUP)
+    case 'c':
+      if (Desc.Type == "cgroup"sv) {
+        AddFlag(CLONE_NEWCGROUP, Desc.Path);
+      }
+      break;
+#endif
+    case 'i':
+      if (Desc.Type == "ipc"sv) {
+        AddFlag(CLONE_NEWIPC, Desc.Path);
+      }
+      break;
+    case 'm':
+      if (Desc.Type == "mount"sv) {
+        AddFlag(CLONE_NEWNS, Desc.Path);
+      }
+      break;
+    case 'n':
+      if (Desc.Type == "network"sv) {
+        AddFlag(CLONE_NEWNET, Desc.Path);
+      }
+      break;
+    case 'p':
+      if (Desc.Type == "pid"sv) {
+        AddFlag(CLONE_NEWPID, Desc.Path);
+      }
+      break;
+#if defined(CLONE_NEWTIME)
+    case 't':
+      if (Desc.Type == "time"sv) {
+        AddFlag(CLONE_NEWTIME, Desc.Path);
+      }
+      break;
+#endif
+    case 'u':
+      if (Desc.Type == "uts"sv) {
+        AddFlag(CLONE_NEWUTS, Desc.Path);
+      } else if (Desc.Type == "user"sv) {
+        AddFlag(CLONE_NEWUSER, Desc.Path);
+      }
+      break;
+    }
+  }
+}
+
+/// Enter the container and run the instantiated module, in the container
+/// process. Init is the initialization export still to run before _start,
+/// empty when a snapshot stands in for it. SpawnedFlags are the namespaces it
+/// was already created in, and InCGroup tells whether it was spawned into the
+/// cgroup of the container. Hosted containers are threads of a host and stay
+/// in its namespaces and cgroup.
+int runContainer(WasmEdge::VM::VM &VM, std::string_view ContainerId,
+                 std::string_view PidFile, RUNW::State &State,
+                 const std::filesystem::path &StateFile, const int ExecFifoFd,
+                 const std::filesystem::path &SoPath, std::string_view Init,
+                 int SpawnedFlags = 0, bool InCGroup = false,
+                 bool Hosted = false) {
+  const auto &Bundle = State.bundle();
+  WasmEdge::Host::WasiModule *WasiMod =
+      dynamic_cast<WasmEdge::Host::WasiModule *>(
+          VM.getImportModule(WasmEdge::HostRegistration::Wasi));
+
+  if (!atomicCreateAndWriteFile(std::filesystem::u8path(PidFile),
+                                [](auto &Stream) { Stream << getpid(); })) {
+    spdlog::error("pid file update failed"sv);
+    return EXIT_FAILURE;
+  }
+
+  State.setCreated();
+  // A new or joined user namespace takes away the privileges the other
+  // namespaces, the cgroup and the state files need, so it is entered last
+  bool NewUserNs = false;
+  int UserNsFd = -1;
+  if (!Hosted) {
+    int UnshareFlags = 0;
+    std::vector<std::pair<std::string, int>> JoinPaths;
+    collectNamespaces(Bundle, UnshareFlags, JoinPaths);
+    UnshareFlags &= ~SpawnedFlags;
+    NewUserNs = (UnshareFlags & CLONE_NEWUSER) != 0;
+    UnshareFlags &= ~CLONE_NEWUSER;
+    std::vector<std::pair<int, int>> SetNsFlags;
+    for (const auto &[Path, Flag] : JoinPaths) {
+      int Fd = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (Fd < 0) {
+        spdlog::error("open {}:{}"sv, Path, std::strerror(errno));
+        return EXIT_FAILURE;
+      }
+      if (Flag == CLONE_NEWUSER) {
+        UserNsFd = Fd;
+      } else {
+        SetNsFlags.emplace_back(Fd, Flag);
+      }
+    }
+    if (UnshareFlags != 0 && unshare(UnshareFlags) < 0) {
+      spdlog::error("cannot unshare: {}"sv, std::strerror(errno));
+      return EXIT_FAILURE;
+    }
+    bool SetNsFailed = false;
+    for (const auto &[Fd, Flag] : SetNsFlags) {
+      if (int Ret = setns(Fd, Flag); Ret < 0) {
+        spdlog::error("cannot setns: {}"sv, std::strerror(errno));
+        SetNsFailed = true;
+      }
+      close(Fd);
+    }
+    if (SetNsFailed) {
+      return EXIT_FAILURE;
+    }
+  }
+  if (!InCGroup && !Hosted) {
+    if (auto Res = RUNW::CGroup::enter(ContainerId, State); !Res) {
+      return EXIT_FAILURE;
+    }
+  }
+  if (!atomicUpdateFile(StateFile,
+                        [&](auto &Stream) { State.print(Stream); })) {
+    spdlog::error("state file update failed"sv);
+    return EXIT_FAILURE;
+  }
+  if (NewUserNs && unshare(CLONE_NEWUSER) < 0) {
+    spdlog::error("cannot unshare user namespace: {}"sv, std::strerror(errno));
+    return EXIT_FAILURE;
+  }
+  if (UserNsFd >= 0) {
+    const int Ret = setns(UserNsFd, CLONE_NEWUSER);
+    const int Err = errno;
+    close(UserNsFd);
+    if (Ret < 0) {
+      spdlog::error("cannot setns user namespace: {}"sv, std::strerror(Err));
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (ExecFifoFd >= 0) {
+    char Buffer[1];
+    // Unlike select, poll takes fds past FD_SETSIZE, which the exec fifos of
+    // a host with many instances reach
+    pollfd PollFd = {ExecFifoFd, POLLIN, 0};
+    // A killed instance of a host is interrupted too, and does not start
+    while (poll(&PollFd, 1, -1) < 0) {
+      if (errno != EINTR || RUNW::Host::stopping()) {
+        spdlog::error("poll exec fifo failed: {}"sv, std::strerror(errno));
+        return EXIT_FAILURE;
+      }
+    }
+    while (read(ExecFifoFd, Buffer, sizeof(Buffer)) < 0) {
+      if (errno != EINTR || RUNW::Host::stopping()) {
+        spdlog::error("read exec fifo failed: {}"sv, std::strerror(errno));
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  State.setRunning();
+  if (!atomicUpdateFile(StateFile,
+                        [&](auto &Stream) { State.print(Stream); })) {
+    return EXIT_FAILURE;
+  }
+
+  // Instances of a host share its stdio with the other instances, and output
+  // to a terminal is not held back
+  RUNW::OutputStage Output;
+  if (Bundle.outputBufferSize() > 0 && !Bundle.terminal() && !Hosted) {
+    if (auto Res = Output.start(
+            Bundle.outputBufferSize(),
+            std::chrono::milliseconds(Bundle.outputFlushInterval()));
+        !Res) {
+      spdlog::error("output stage not started, writing output directly"sv);
+    }
+  }
+
+  spdlog::info("wasm running"sv);
+
+  const auto StartTime = std::chrono::steady_clock::now();
+  // Guest code only runs once the container is isolated and started, the
+  // initialization export included
+  bool Executed = true;
+  for (const auto Func : {Init, "_start"sv}) {
+    if (Func.empty()) {
+      continue;
+    }
+    if (RUNW::Host::stopping()) {
+      Executed = false;
+      break;
+    }
+    const auto FuncStartTime = std::chrono::steady_clock::now();
+    auto Res = VM.execute(Func);
+    spdlog::info("execute {} took {}us"sv, Func,
+                 std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - FuncStartTime)
+                     .count());
+    if (!Res) {
+      spdlog::error("execute {} failed: {}"sv, Func,
+                    WasmEdge::ErrCodeStr[Res.error()]);
+      Executed = false;
+      break;
+    }
+  }
+  Output.stop();
+
+  spdlog::info("wasm stopped"sv);
+
+  const int ExitCode =
+      Executed ? WasiMod->getEnv().getExitCode() : EXIT_FAILURE;
+  State.setStopped(ExitCode);
+
+  if (Bundle.recordRunTime()) {
+    RUNW::AOTCache::recordRun(SoPath,
+                              std::chrono::steady_clock::now() - StartTime);
+  }
+
+  if (!atomicUpdateFile(StateFile,
+                        [&](auto &Stream) { State.print(Stream); })) {
+    return EXIT_FAILURE;
+  }
+
+  return ExitCode;
+}
+
+/// Restore the snapshot of SoPath into an instantiated VM, if there is one
+/// that fits. Restored tells whether it stands in for the Init export, and
+/// false is returned when the instance is unusable.
+bool restoreSnapshot(WasmEdge::VM::VM &VM, std::string_view Init,
+                     const std::filesystem::path &SoPath, bool &Restored) {
+  auto Res = RUNW::Snapshot::restore(VM, Init, SoPath);
+  Restored = Res.has_value();
+  if (Restored) {
+    spdlog::info("wasm restored from snapshot"sv);
+  }
+  return Res || Res.error() != ENOMEM;
+}
+
+/// Log how long a stage of create took since Start, and start the next one.
+void logStage(std::string_view Name,
+              std::chrono::steady_clock::time_point &Start) {
+  const auto Now = std::chrono::steady_clock::now();
+  spdlog::info(
+      "stage {} took {}ms"sv, Name,
+      std::chrono::duration_cast<std::chrono::milliseconds>(Now - Start)
+          .count());
+  Start = Now;
+}
+
+/// Container scope started by a placeholder child process.
+struct Setup {
+  pid_t Pid = -1;
+  /// Yields one byte once the scope is started, and end of file otherwise
+  int StatusFd = -1;
+};
+
+/// Start the scope of the container from a child process, which stays in it
+/// as a placeholder until the container process joins, so runw itself never
+/// enters the scope. The caller goes on with the module meanwhile and
+/// collects the result with finishSetup before it spawns the container.
+Setup startSetup(std::string_view ContainerId, const RUNW::State &State) {
+  Setup Result;
+  std::array<int, 2> StatusPipe;
+  if (pipe2(StatusPipe.data(), O_CLOEXEC) < 0) {
+    spdlog::error("pipe failed: {}"sv, std::strerror(errno));
+    return Result;
+  }
+  const pid_t Parent = getpid();
+  const pid_t Pid = fork();
+  if (WasmEdge::unlikely(Pid < 0)) {
+    spdlog::error("fork failed: {}"sv, std::strerror(errno));
+    close(StatusPipe[0]);
+    close(StatusPipe[1]);
+    return Result;
+  }
+  if (Pid == 0) {
+    close(StatusPipe[0]);
+    // Do not hold the scope for a runw that failed before spawning
+    if (prctl(PR_SET_PDEATHSIG, SIGKILL) < 0 || getppid() != Parent) {
+      _exit(EXIT_FAILURE);
+    }
+    auto Start = std::chrono::steady_clock::now();
+    if (!RUNW::CGroup::prepare(ContainerId, State, getpid())) {
+      exit(EXIT_FAILURE);
+    }
+    logStage("setup"sv, Start);
+    const char Ready = 0;
+    while (write(StatusPipe[1], &Ready, sizeof(Ready)) < 0 && errno == EINTR) {
+    }
+    while (true) {
+      pause();
+    }
+  }
+  close(StatusPipe[1]);
+  Result.Pid = Pid;
+  Result.StatusFd = StatusPipe[0];
+  return Result;
+}
+
+/// Wait until the placeholder started the scope, or gave up.
+bool finishSetup(Setup &Setup) {
+  char Ready;
+  ssize_t Size;
+  do {
+    Size = read(Setup.StatusFd, &Ready, sizeof(Ready));
+  } while (Size < 0 && errno == EINTR);
+  close(Setup.StatusFd);
+  Setup.StatusFd = -1;
+  return Size == sizeof(Ready);
+}
+
+/// Kill and reap the placeholder, once the container process holds the
+/// scope or the create failed.
+void stopSetup(Setup &Setup) {
+  if (Setup.Pid <= 0) {
+    return;
+  }
+  kill(Setup.Pid, SIGKILL);
+  while (waitpid(Setup.Pid, nullptr, 0) < 0 && errno == EINTR) {
+  }
+  Setup.Pid = -1;
+}
+
+int doRunInternal(std::string_view ContainerId, std::string_view PidFile,
+                  RUNW::State &State, const std::filesystem::path &StateFile,
+                  const int ExecFifoFd,
+                  const int ConsoleSocketFd [[maybe_unused]],
+                  bool Interruptible,
+                  const RUNW::CGroup::Resources &CompileLimits) {
+  const auto Conf = createConfigure(Interruptible);
+  WasmEdge::VM::VM VM(Conf);
+  const auto &Bundle = State.bundle();
+
+  auto RootPath = std::filesystem::u8path(Bundle.rootPath());
+  auto Cwd = RootPath;
+  Cwd += std::filesystem::u8path(Bundle.cwd());
+  auto WasmPath = Cwd / std::filesystem::u8path(Bundle.args()[0]);
+  initHostModules(VM, Bundle, RootPath, WasmPath);
+
+  // Start the container scope in a child process, so the D-Bus round trip
+  // overlaps with compiling and instantiating the module
+  auto Stage = std::chrono::steady_clock::now();
+  Setup Setup;
+  if (RUNW::CGroup::unified()) {
+    Setup = startSetup(ContainerId, State);
+  }
+
+  // Held from verifying the artifact until its reference is taken, so cache
+  // gc cannot evict it in between
+  RUNW::AOTCache::Lock EntryLock;
+  std::filesystem::path SoPath;
+  if (auto Res = RUNW::AOTCache::lookup(WasmPath, Conf, EntryLock)) {
+    SoPath = std::move(*Res);
+    spdlog::info("cache index hit: {}"sv, SoPath);
+  }
+
+  // Run in the interpreter while the artifact is not yet compiled
+  bool Interpret = false;
+  if (SoPath.empty()) {
+    WasmEdge::Loader::Loader Loader(Conf);
+    std::vector<WasmEdge::Byte> Data;
+    if (auto Res = Loader.loadFile(WasmPath)) {
+      Data = std::move(*Res);
+    } else {
+      const auto Err = static_cast<uint32_t>(Res.error());
+      spdlog::info("Load failed. Error code: {}", Err);
+      return EXIT_FAILURE;
+    }
+
+    if (auto Res = RUNW::AOTCache::getPath(Data, Conf)) {
+      SoPath = std::move(*Res);
+    } else {
+      const auto Err = static_cast<uint32_t>(Res.error());
+      spdlog::info("Cache path get failed. Error code: {}", Err);
+      return EXIT_FAILURE;
+    }
+
+    if (std::error_code ErrCode;
+        std::filesystem::create_directories(SoPath.parent_path(), ErrCode),
+        ErrCode) {
+      spdlog::error(ErrCode.message());
+    }
+    bool Verified = false;
+    if (auto Shared = RUNW::AOTCache::lock(SoPath, true, true);
+        Shared && RUNW::AOTCache::verify(SoPath, Conf)) {
+      EntryLock = std::move(*Shared);
+      Verified = true;
+    }
+
+    if (!Verified) {
+      const bool Tiered = Bundle.tieredExecution();
+      // Prefer the node compile service, it holds the entry lock itself. It
+      // compiles plain code only.
+      bool Served = false;
+      if (!Interruptible &&
+          RUNW::CompileServer::request(SoPath, WasmPath, !Tiered)) {
+        if (Tiered) {
+          Served = true;
+        } else if (auto Shared = RUNW::AOTCache::lock(SoPath, true, true);
+                   Shared && RUNW::AOTCache::verify(SoPath, Conf)) {
+          EntryLock = std::move(*Shared);
+          Served = true;
+        }
+        Interpret = Tiered;
+      }
+
+      RUNW::AOTCache::Lock Lock;
+      if (Served) {
+        spdlog::info("artifact compiled by compile server"sv);
+      } else if (auto Res = RUNW::AOTCache::lock(SoPath, !Tiered)) {
+        Lock = std::move(*Res);
+      } else if (Tiered && Res.error() == EWOULDBLOCK) {
+        spdlog::info("artifact is being compiled by another creator"sv);
+        Interpret = true;
+      } else {
+        return EXIT_FAILURE;
+      }
+
+      if (!Interpret && !Served) {
+        // Another creator may have published the artifact while we waited
+        if (RUNW::AOTCache::verify(SoPath, Conf)) {
+          spdlog::info("reuse compiled artifact"sv);
+        } else if (!compileModule(Conf, Loader, Data, SoPath, !Tiered, Lock,
+                                  CompileLimits)) {
+          return EXIT_FAILURE;
+        } else {
+          Interpret = Tiered;
+        }
+      }
+      if (!Interpret && !Served) {
+        EntryLock = std::move(Lock);
+      }
+    }
+
+    if (Interpret) {
+      spdlog::info("start in interpreter"sv);
+      if (auto Res = VM.loadWasm(Data); !Res) {
+        return EXIT_FAILURE;
+      }
+    }
+
+    RUNW::AOTCache::index(WasmPath, Conf, SoPath);
+  }
+
+  logStage("compile"sv, Stage);
+
+  if (!Interpret) {
+    if (auto Res = RUNW::AOTCache::acquire(SoPath, StateFile.parent_path());
+        !Res) {
+      return EXIT_FAILURE;
+    }
+    EntryLock = RUNW::AOTCache::Lock();
+
+    if (auto Res = VM.loadWasm(RUNW::AOTCache::locate(SoPath, Conf)); !Res) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  spdlog::info("wasm loaded"sv);
+  logStage("load"sv, Stage);
+
+  if (auto Res = VM.validate(); !Res) {
+    return EXIT_FAILURE;
+  }
+
+  spdlog::info("wasm validated"sv);
+  logStage("validate"sv, Stage);
+
+  if (auto Res = VM.instantiate(); !Res) {
+    return EXIT_FAILURE;
+  }
+
+  spdlog::info("wasm instantiate"sv);
+  logStage("instantiate"sv, Stage);
+
+  bool Restored;
+  if (!restoreSnapshot(VM, Bundle.snapshotInit(), SoPath, Restored)) {
+    return EXIT_FAILURE;
+  }
+  const std::string_view Init = Restored ? ""sv : Bundle.snapshotInit();
+
+  logStage("restore"sv, Stage);
+
+  // Spawn the container process in its cgroup and new namespaces, instead of
+  // moving it there after it started
+  int CGroupFd = -1;
+  if (Setup.Pid > 0) {
+    if (!finishSetup(Setup)) {
+      // No scope yet, the container process starts it itself
+      stopSetup(Setup);
+    } else if (auto Res = RUNW::CGroup::target(Setup.Pid)) {
+      CGroupFd = *Res;
+    } else {
+      // The container process cannot start a scope that already exists
+      stopSetup(Setup);
+      return EXIT_FAILURE;
+    }
+  }
+  const bool InCGroup = CGroupFd >= 0;
+  logStage("setup wait"sv, Stage);
+  int SpawnFlags = 0;
+  {
+    std::vector<std::pair<std::string, int>> JoinPaths;
+    collectNamespaces(Bundle, SpawnFlags, JoinPaths);
+    SpawnFlags &= kCloneNamespaces;
+  }
+
+  bool Forked = false;
+  pid_t WasmPid = spawnContainer(CGroupFd, SpawnFlags);
+  if (WasmPid < 0 && (errno == ENOSYS || errno == E2BIG || errno == EINVAL)) {
+    // Kernels before 5.7 lack clone3 or CLONE_INTO_CGROUP
+    spdlog::info("clone3 failed: {}, fall back to fork"sv,
+                 std::strerror(errno));
+    SpawnFlags = 0;
+    Forked = true;
+    WasmPid = fork();
+  }
+  if (WasmPid == 0) {
+    if (CGroupFd >= 0) {
+      close(CGroupFd);
+    }
+    return runContainer(VM, ContainerId, PidFile, State, StateFile,
+                        ExecFifoFd, SoPath, Init, SpawnFlags, InCGroup);
+  }
+
+  const int SpawnErr = errno;
+  bool Joined = true;
+  if (InCGroup) {
+    // A forked container process is moved in before the placeholder leaves
+    if (WasmPid > 0 && Forked && !RUNW::CGroup::join(CGroupFd, WasmPid)) {
+      kill(WasmPid, SIGKILL);
+      Joined = false;
+    }
+    close(CGroupFd);
+  }
+  stopSetup(Setup);
+  if (WasmEdge::unlikely(WasmPid < 0)) {
+    spdlog::error("fork failed: {}"sv, std::strerror(SpawnErr));
+    return EXIT_FAILURE;
+  }
+  if (!Joined) {
+    return EXIT_FAILURE;
+  }
+
+  RUNW::PidFd::track(WasmPid, StateFile.parent_path());
+  logStage("spawn"sv, Stage);
+  return EXIT_SUCCESS;
+}
+
+int doCreate(std::string_view Root, bool SystemdCgroup [[maybe_unused]],
+             std::string_view ConfigFileName, std::string_view ContainerId,
+             std::string_view Path, std::string_view ConsoleSocket,
+             std::string_view PidFile, bool UseServices,
+             const RUNW::CGroup::Resources &CompileLimits) {
+  RUNW::AOTCache::migrate();
+
+  const auto ContainerRoot = std::filesystem::u8path(Root) / ContainerId;
+  if (std::error_code ErrCode;
+      !std::filesystem::create_directories(ContainerRoot, ErrCode)) {
+    spdlog::error(ErrCode.message());
+    return EXIT_FAILURE;
+  }
+
+  bool Success = false;
+  BOOST_SCOPE_EXIT_ALL(&) {
+    if (!Success) {
+      std::error_code ErrCode;
+      std::filesystem::remove_all(ContainerRoot, ErrCode);
+    }
+  };
+
+  const auto StateFile = ContainerRoot / "state.json"sv;
+  RUNW::State State(ContainerId, Path);
+  if (!State.loadBundle(ConfigFileName)) {
+    spdlog::error("load bundle failed"sv);
+    return EXIT_FAILURE;
+  }
+
+  State.setSystemdCgroup(SystemdCgroup);
+
+  State.setCreating();
+  if (!atomicCreateAndWriteFile(StateFile,
+                                [&](auto &Stream) { State.print(Stream); })) {
+    spdlog::error("state file update failed"sv);
+    return EXIT_FAILURE;
+  }
+
+  const auto ExecFifoFile = ContainerRoot / "exec.fifo"sv;
+  if (int Ret = mkfifo(ExecFifoFile.u8string().c_str(), 0600); Ret < 0) {
+    spdlog::error("mkfifo failed: {}"sv, std::strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  int ExecFifoFd = open(ExecFifoFile.u8string().c_str(), O_RDONLY | O_NONBLOCK);
+  BOOST_SCOPE_EXIT_ALL(&ExecFifoFd) {
+    if (ExecFifoFd >= 0) {
+      close(ExecFifoFd);
+    }
+  };
+  if (ExecFifoFd < 0) {
+    spdlog::error("open fifo failed: {}"sv, std::strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  int Pipe[2];
+  if (WasmEdge::unlikely(pipe(Pipe) < 0)) {
+    spdlog::error("pipe failed: {}"sv, std::strerror(errno));
+    return EXIT_FAILURE;
+  }
+  const pid_t ChildPid = fork();
+  if (WasmEdge::unlikely(ChildPid < 0)) {
+    spdlog::error("fork failed: {}"sv, std::strerror(errno));
+    return EXIT_FAILURE;
+  }
+  if (ChildPid > 0) {
+    // server
+    close(Pipe[1]);
+    do {
+      if (auto Result = waitpid(ChildPid, nullptr, 0); Result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+      }
+    } while (false);
+    int ExitCode;
+    do {
+      if (auto Result = read(Pipe[0], &ExitCode, sizeof(ExitCode));
+          Result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        spdlog::error("parent read failed: {}"sv, std::strerror(errno));
+        return EXIT_FAILURE;
+      } else if (Result > 0) {
+        if (ExitCode != 0) {
+          return EXIT_FAILURE;
+        }
+      }
+    } while (false);
+
+    close(Pipe[0]);
+    Success = true;
+    return EXIT_SUCCESS;
+  }
+
+  // child
+  close(Pipe[0]);
+  if (setsid() < 0) {
+    return EXIT_FAILURE;
+  }
+  pid_t DaemonPid = fork();
+  if (DaemonPid < 0) {
+    return EXIT_FAILURE;
+  }
+  if (DaemonPid > 0) {
+    // child
+    Success = true;
+    _Exit(EXIT_SUCCESS);
+  }
+
+  // daemon
+
+  int ConsoleSocketFd = -1;
+  BOOST_SCOPE_EXIT_ALL(&ConsoleSocketFd) {
+    if (ConsoleSocketFd >= 0) {
+      close(ConsoleSocketFd);
+    }
+  };
+  if (!ConsoleSocket.empty()) {
+    ConsoleSocketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ConsoleSocketFd < 0) {
+      spdlog::error("socket failed: {}"sv, std::strerror(errno));
+      return EXIT_FAILURE;
+    }
+    struct sockaddr_un Addr = {};
+    if (ConsoleSocket.size() >= sizeof(Addr.sun_path)) {
+      spdlog::error("socket path too long: {}"sv, ConsoleSocket);
+      return EXIT_FAILURE;
+    }
+    std::copy(ConsoleSocket.begin(), ConsoleSocket.end(), Addr.sun_path);
+    Addr.sun_family = AF_UNIX;
+    if (auto Ret =
+            connect(ConsoleSocketFd, reinterpret_cast<struct sockaddr *>(&Addr),
+                    sizeof(Addr));
+        Ret < 0) {
+      spdlog::error("socket connect failed: {}"sv, std::strerror(errno));
+      return EXIT_FAILURE;
+    }
+  }
+
+  {
+    // The pid file of a hosted container holds the pid of the host, which
+    // outlives the container, so only callers that opt in get hosted
+    const auto HostName = State.bundle().hostName();
+    const bool Hosted = UseServices && !HostName.empty();
+    if (!UseServices && !HostName.empty()) {
+      spdlog::info("host {} needs --use-services"sv, HostName);
+    }
+    int ExitCode;
+    if (Hosted &&
+        RUNW::Host::request(HostName, {ContainerRoot, std::string(ContainerId),
+                                       std::string(PidFile),
+                                       std::string(ConfigFileName),
+                                       ExecFifoFd})) {
+      spdlog::info("container started by host {}"sv, HostName);
+      ExitCode = EXIT_SUCCESS;
+    } else if (UseServices && !Hosted &&
+               RUNW::Zygote::request({ContainerRoot, std::string(ContainerId),
+                                      std::string(PidFile),
+                                      std::string(ConfigFileName),
+                                      ExecFifoFd})) {
+      spdlog::info("container forked by zygote"sv);
+      ExitCode = EXIT_SUCCESS;
+    } else {
+      // Containers the host turned away compile the artifact it runs
+      ExitCode = doRunInternal(ContainerId, PidFile, State, StateFile,
+                               ExecFifoFd, ConsoleSocketFd, Hosted,
+                               CompileLimits);
+    }
+    write(Pipe[1], &ExitCode, sizeof(ExitCode));
+    close(Pipe[1]);
+  }
+
+  Success = true;
+  return EXIT_FAILURE;
+}
+
+/// Compile WasmPath into the cache unless it is compiled already. SoPath is
+/// the artifact path of the module, when the caller has hashed it already.
+bool precompileModule(const WasmEdge::Configure &Conf,
+                      const std::filesystem::path &WasmPath,
+                      const RUNW::CGroup::Resources &Limits,
+                      std::filesystem::path SoPath = {}) {
+  WasmEdge::Loader::Loader Loader(Conf);
+  std::vector<WasmEdge::Byte> Data;
+  if (auto Res = Loader.loadFile(WasmPath)) {
+    Data = std::move(*Res);
+  } else {
+    const auto Err = static_cast<uint32_t>(Res.error());
+    spdlog::error("{} load failed. Error code: {}"sv, WasmPath, Err);
+    return false;
+  }
+
+  if (SoPath.empty()) {
+    if (auto Res = RUNW::AOTCache::getPath(Data, Conf)) {
+      SoPath = std::move(*Res);
+    } else {
+      const auto Err = static_cast<uint32_t>(Res.error());
+      spdlog::error("Cache path get failed. Error code: {}", Err);
+      return false;
+    }
+  }
+
+  if (RUNW::AOTCache::verify(SoPath, Conf)) {
+    spdlog::info("{} already compiled"sv, WasmPath);
+    return true;
+  }
+
+  if (std::error_code ErrCode;
+      std::filesystem::create_directories(SoPath.parent_path(), ErrCode),
+      ErrCode) {
+    spdlog::error(ErrCode.message());
+    return false;
+  }
+
+  RUNW::AOTCache::Lock Lock;
+  if (auto Res = RUNW::AOTCache::lock(SoPath)) {
+    Lock = std::move(*Res);
+  } else {
+    return false;
+  }
+  if (RUNW::AOTCache::verify(SoPath, Conf)) {
+    return true;
+  }
+
+  spdlog::info("compiling {}"sv, WasmPath);
+  return compileArtifact(Conf, Loader, Data, SoPath, Limits);
+}
+
+void collectWasmFiles(const std::filesystem::path &Dir,
+                      std::set<std::filesystem::path> &Modules) {
+  std::error_code ErrCode;
+  for (std::filesystem::recursive_directory_iterator Iter(Dir, ErrCode), End;
+       !ErrCode && Iter != End; Iter.increment(ErrCode)) {
+    if (Iter->path().extension() == ".wasm"sv &&
+        Iter->is_regular_file(ErrCode)) {
+      Modules.insert(Iter->path());
+    }
+  }
+  if (ErrCode) {
+    spdlog::error("scan {} failed: {}"sv, Dir, ErrCode.message());
+  }
+}
+
+/// Accept a wasm file, an OCI bundle, or a directory such as an image rootfs.
+bool collectModules(const std::filesystem::path &Path,
+                    std::string_view ConfigFileName,
+                    std::set<std::filesystem::path> &Modules) {
+  std::error_code ErrCode;
+  if (std::filesystem::is_regular_file(Path, ErrCode)) {
+    Modules.insert(Path);
+    return true;
+  }
+  if (!std::filesystem::is_directory(Path, ErrCode)) {
+    spdlog::error("{} is neither a file nor a directory"sv, Path);
+    return false;
+  }
+  if (!std::filesystem::is_regular_file(Path / ConfigFileName, ErrCode)) {
+    collectWasmFiles(Path, Modules);
+    return true;
+  }
+
+  RUNW::Bundle Bundle;
+  if (!Bundle.load(Path, ConfigFileName)) {
+    return false;
+  }
+  auto RootPath = std::filesystem::u8path(Bundle.rootPath());
+  if (RootPath.is_relative()) {
+    RootPath = Path / RootPath;
+  }
+  if (!Bundle.args().empty()) {
+    auto Cwd = RootPath;
+    Cwd += std::filesystem::u8path(Bundle.cwd());
+    Modules.insert(Cwd / std::filesystem::u8path(Bundle.args()[0]));
+  }
+  collectWasmFiles(RootPath, Modules);
+  return true;
+}
+
+/// Artifact paths of Modules, ordered by the run time recorded for them,
+/// hottest first. Modules already compiled are left out. Each module is hashed
+/// once here; the workers reuse its artifact path.
+std::vector<std::pair<std::filesystem::path, std::filesystem::path>>
+sortByRunTime(const WasmEdge::Configure &Conf,
+              const std::vector<std::filesystem::path> &Modules) {
+  std::vector<std::pair<std::filesystem::path, std::filesystem::path>> Sorted;
+  std::map<std::filesystem::path, std::chrono::nanoseconds> Heat;
+  WasmEdge::Loader::Loader Loader(Conf);
+  for (const auto &Module : Modules) {
+    std::filesystem::path SoPath;
+    if (auto Data = Loader.loadFile(Module)) {
+      if (auto Res = RUNW::AOTCache::getPath(*Data, Conf)) {
+        SoPath = std::move(*Res);
+      }
+    }
+    if (!SoPath.empty() && RUNW::AOTCache::verify(SoPath, Conf)) {
+      spdlog::info("{} already compiled"sv, Module);
+      continue;
+    }
+    Heat[Module] = SoPath.empty() ? std::chrono::nanoseconds(0)
+                                  : RUNW::AOTCache::runTime(SoPath);
+    Sorted.emplace_back(Module, std::move(SoPath));
+  }
+  std::stable_sort(Sorted.begin(), Sorted.end(),
+                   [&Heat](const auto &LHS, const auto &RHS) {
+                     return Heat[LHS.first] > Heat[RHS.first];
+                   });
+  return Sorted;
+}
+
+int doPrecompile(WasmEdge::Span<const std::string> Paths,
+                 std::string_view ConfigFileName, uint32_t Jobs,
+                 bool HottestFirst,
+                 const RUNW::CGroup::Resources &CompileLimits) {
+  std::set<std::filesystem::path> ModuleSet;
+  for (const auto &Path : Paths) {
+    if (!collectModules(std::filesystem::u8path(Path), ConfigFileName,
+                        ModuleSet)) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (Jobs == 0) {
+    cpu_set_t Set;
+    Jobs = sched_getaffinity(0, sizeof(Set), &Set) < 0 ? 1 : CPU_COUNT(&Set);
+  }
+  spdlog::info("precompile {} modules with {} jobs"sv, ModuleSet.size(), Jobs);
+
+  const auto Conf = createConfigure();
+  std::vector<std::pair<std::filesystem::path, std::filesystem::path>> Modules;
+  if (HottestFirst) {
+    Modules = sortByRunTime(
+        Conf, std::vector<std::filesystem::path>(ModuleSet.begin(),
+                                                 ModuleSet.end()));
+  } else {
+    for (const auto &Module : ModuleSet) {
+      Modules.emplace_back(Module, std::filesystem::path());
+    }
+  }
+  uint32_t Running = 0;
+  bool Failed = false;
+  auto &&Reap = [&Running, &Failed]() {
+    int Status;
+    pid_t Pid;
+    do {
+      Pid = waitpid(-1, &Status, 0);
+    } while (Pid < 0 && errno == EINTR);
+    if (Pid < 0) {
+      spdlog::error("waitpid failed: {}"sv, std::strerror(errno));
+      Failed = true;
+      Running = 0;
+      return;
+    }
+    --Running;
+    if (!WIFEXITED(Status) || WEXITSTATUS(Status) != EXIT_SUCCESS) {
+      Failed = true;
+    }
+  };
+
+  for (const auto &[Module, SoPath] : Modules) {
+    if (Running >= Jobs) {
+      Reap();
+    }
+    const pid_t Pid = fork();
+    if (WasmEdge::unlikely(Pid < 0)) {
+      spdlog::error("fork failed: {}"sv, std::strerror(errno));
+      Failed = true;
+      break;
+    }
+    if (Pid == 0) {
+      exit(precompileModule(Conf, Module, CompileLimits, SoPath)
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE);
+    }
+    ++Running;
+  }
+  while (Running > 0) {
+    Reap();
+  }
+
+  return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int doCache(std::string_view Root, std::string_view Action, uint64_t MaxSize,
+            uint64_t HotSize) {
+  const auto ContainerDir = std::filesystem::u8path(Root);
+  if (Action == "gc"sv) {
+    if (auto Res = RUNW::AOTCache::collect(ContainerDir, MaxSize, HotSize);
+        !Res) {
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  const auto Entries = RUNW::AOTCache::list(ContainerDir);
+  if (Action == "ls"sv) {
+    for (const auto &Entry : Entries) {
+      char Buffer[64];
+      const auto Size =
+          std::strftime(Buffer, sizeof(Buffer), "%Y-%m-%dT%H:%M:%SZ",
+                        std::gmtime(&Entry.LastUse));
+      std::cout << Entry.Path.u8string() << ' ' << Entry.Size << ' '
+                << std::string_view(Buffer, Size) << ' ' << Entry.References
+                << (Entry.Hot ? " hot"sv : ""sv) << '\n';
+    }
+    return EXIT_SUCCESS;
+  } else if (Action == "stats"sv) {
+    uint64_t Total = 0, HotTotal = 0, Referenced = 0;
+    for (const auto &Entry : Entries) {
+      Total += Entry.Size;
+      HotTotal += Entry.Hot ? Entry.Size : 0;
+      Referenced += Entry.References > 0 ? 1 : 0;
+    }
+    std::cout << "root: "sv << RUNW::AOTCache::root().u8string() << '\n'
+              << "entries: "sv << Entries.size() << '\n'
+              << "referenced: "sv << Referenced << '\n'
+              << "size: "sv << Total << '\n'
+              << "hot size: "sv << HotTotal << '\n';
+    return EXIT_SUCCESS;
+  }
+
+  spdlog::error("unknown cache action: {}"sv, Action);
+  return EXIT_FAILURE;
+}
+
+int doSnapshot(std::string_view BundlePath, std::string_view ConfigFileName) {
+  const auto Path = std::filesystem::u8path(BundlePath);
+  RUNW::Bundle Bundle;
+  if (!Bundle.load(Path, ConfigFileName)) {
+    return EXIT_FAILURE;
+  }
+  const auto Init = Bundle.snapshotInit();
+  if (Bundle.args().empty()) {
+    spdlog::error("bundle has no args"sv);
+    return EXIT_FAILURE;
+  }
+
+  auto RootPath = std::filesystem::u8path(Bundle.rootPath());
+  if (RootPath.is_relative()) {
+    RootPath = Path / RootPath;
+  }
+  auto Cwd = RootPath;
+  Cwd += std::filesystem::u8path(Bundle.cwd());
+  std::vector<std::string> Args(Bundle.args().begin(), Bundle.args().end());
+  std::vector<std::string> Envs(Bundle.envs().begin(), Bundle.envs().end());
+  const auto WasmPath = Cwd / std::filesystem::u8path(Args[0]);
+
+  const auto Conf = createConfigure();
+  WasmEdge::VM::VM VM(Conf);
+  WasmEdge::Host::WasiModule *WasiMod =
+      dynamic_cast<WasmEdge::Host::WasiModule *>(
+          VM.getImportModule(WasmEdge::HostRegistration::Wasi));
+  WasiMod->getEnv().init(
+      std::array{"/:"s + RootPath.u8string()}, WasmPath.u8string(),
+      WasmEdge::Span<const std::string>(Args).subspan(1), Envs);
+
+  WasmEdge::Loader::Loader Loader(Conf);
+  std::vector<WasmEdge::Byte> Data;
+  if (auto Res = Loader.loadFile(WasmPath)) {
+    Data = std::move(*Res);
+  } else {
+    const auto Err = static_cast<uint32_t>(Res.error());
+    spdlog::error("{} load failed. Error code: {}"sv, WasmPath, Err);
+    return EXIT_FAILURE;
+  }
+  std::filesystem::path SoPath;
+  if (auto Res = RUNW::AOTCache::getPath(Data, Conf)) {
+    SoPath = std::move(*Res);
+  } else {
+    const auto Err = static_cast<uint32_t>(Res.error());
+    spdlog::error("Cache path get failed. Error code: {}", Err);
+    return EXIT_FAILURE;
+  }
+  if (std::error_code ErrCode;
+      std::filesystem::create_directories(SoPath.parent_path(), ErrCode),
+      ErrCode) {
+    spdlog::error(ErrCode.message());
+    return EXIT_FAILURE;
+  }
+
+  // Keep cache gc away from the partial snapshot
+  RUNW::AOTCache::Lock Lock;
+  if (auto Res = RUNW::AOTCache::lock(SoPath)) {
+    Lock = std::move(*Res);
+  } else {
+    return EXIT_FAILURE;
+  }
+
+  // Memory layout does not depend on the tier, use the artifact if it exists
+  if (RUNW::AOTCache::verify(SoPath, Conf)) {
+    if (auto Res = VM.loadWasm(RUNW::AOTCache::locate(SoPath, Conf)); !Res) {
+      return EXIT_FAILURE;
+    }
+  } else if (auto Res = VM.loadWasm(Data); !Res) {
+    return EXIT_FAILURE;
+  }
+  if (auto Res = VM.validate(); !Res) {
+    return EXIT_FAILURE;
+  }
+  if (auto Res = VM.instantiate(); !Res) {
+    return EXIT_FAILURE;
+  }
+
+  if (auto Res = RUNW::Snapshot::capture(VM, Init, SoPath); !Res) {
+    return EXIT_FAILURE;
+  }
+  std::cout << RUNW::Snapshot::path(SoPath).u8string() << '\n';
+  return EXIT_SUCCESS;
+}
+
+/// Inode and modification times of an artifact and its snapshot, which change
+/// whenever either is published again, evicted or recompiled.
+using ArtifactStamp = std::tuple<dev_t, ino_t, int64_t, int64_t>;
+
+ArtifactStamp artifactStamp(const std::filesystem::path &SoPath) noexcept {
+  ArtifactStamp Stamp{0, 0, -1, -1};
+  struct stat Stat;
+  if (stat(SoPath.c_str(), &Stat) == 0) {
+    std::get<0>(Stamp) = Stat.st_dev;
+    std::get<1>(Stamp) = Stat.st_ino;
+    std::get<2>(Stamp) =
+        int64_t(Stat.st_mtim.tv_sec) * 1000000000 + Stat.st_mtim.tv_nsec;
+  }
+  if (stat(RUNW::Snapshot::path(SoPath).c_str(), &Stat) == 0) {
+    std::get<3>(Stamp) =
+        int64_t(Stat.st_mtim.tv_sec) * 1000000000 + Stat.st_mtim.tv_nsec;
+  }
+  return Stamp;
+}
+
+struct WarmInstance {
+  std::unique_ptr<WasmEdge::VM::VM> VM;
+  std::string Init;
+  bool Restored = false;
+  uint64_t LastUse = 0;
+  /// Artifact the instance was built from, checked before each reuse
+  ArtifactStamp Stamp;
+};
+
+int doZygote(uint32_t MaxInstances) {
+  const auto Conf = createConfigure();
+  std::map<std::filesystem::path, WarmInstance> Instances;
+  uint64_t Clock = 0;
+
+  // The request being served, set up by Prepare for Run
+  RUNW::State State;
+  WarmInstance *Selected = nullptr;
+  std::filesystem::path RootPath, WasmPath, SoPath;
+  // Inherited by the container process, which drops it once referenced
+  RUNW::AOTCache::Lock EntryLock;
+
+  auto &&Prepare = [&](const RUNW::Zygote::Request &Req) {
+    Selected = nullptr;
+    State = RUNW::State();
+    EntryLock = RUNW::AOTCache::Lock();
+    if (!State.load(Req.ContainerRoot / "state.json"sv, Req.ConfigFileName)) {
+      spdlog::error("load state of {} failed"sv, Req.ContainerId);
+      return false;
+    }
+    const auto &Bundle = State.bundle();
+    if (Bundle.args().empty()) {
+      return false;
+    }
+    RootPath = std::filesystem::u8path(Bundle.rootPath());
+    if (RootPath.is_relative()) {
+      RootPath = std::filesystem::u8path(State.bundlePath()) / RootPath;
+    }
+    auto Cwd = RootPath;
+    Cwd += std::filesystem::u8path(Bundle.cwd());
+    WasmPath = Cwd / std::filesystem::u8path(Bundle.args()[0]);
+
+    // Modules that are not compiled yet take the regular create path
+    if (auto Res = RUNW::AOTCache::lookup(WasmPath, Conf, EntryLock)) {
+      SoPath = std::move(*Res);
+    } else {
+      spdlog::info("{} is not compiled yet"sv, WasmPath);
+      return false;
+    }
+
+    // An artifact compiled or snapshotted again since the instance was built
+    // may describe another module
+    const auto Stamp = artifactStamp(SoPath);
+    auto Iter = Instances.find(SoPath);
+    if (Iter != Instances.end() && Iter->second.Stamp != Stamp) {
+      spdlog::info("drop outdated warm instance {}"sv, SoPath);
+      Instances.erase(Iter);
+      Iter = Instances.end();
+    }
+    if (Iter == Instances.end()) {
+      if (MaxInstances > 0 && Instances.size() >= MaxInstances) {
+        auto Oldest = std::min_element(
+            Instances.begin(), Instances.end(),
+            [](const auto &LHS, const auto &RHS) {
+              return LHS.second.LastUse < RHS.second.LastUse;
+            });
+        spdlog::info("drop warm instance {}"sv, Oldest->first);
+        Instances.erase(Oldest);
+      }
+
+      WarmInstance Instance;
+      Instance.Stamp = Stamp;
+      Instance.VM = std::make_unique<WasmEdge::VM::VM>(Conf);
+      auto &VM = *Instance.VM;
+      if (auto Res = VM.loadWasm(RUNW::AOTCache::locate(SoPath, Conf));
+          !Res) {
+        return false;
+      }
+      if (auto Res = VM.validate(); !Res) {
+        return false;
+      }
+      if (auto Res = VM.instantiate(); !Res) {
+        return false;
+      }
+      Instance.Init = Bundle.snapshotInit();
+      if (!restoreSnapshot(VM, Instance.Init, SoPath, Instance.Restored)) {
+        return false;
+      }
+      spdlog::info("warm instance {}"sv, SoPath);
+      Iter = Instances.emplace(SoPath, std::move(Instance)).first;
+    }
+    if (Iter->second.Init != Bundle.snapshotInit()) {
+      spdlog::info("{} uses another snapshot init export"sv, WasmPath);
+      return false;
+    }
+    Iter->second.LastUse = ++Clock;
+    Selected = &Iter->second;
+    return true;
+  };
+
+  auto &&Run = [&](const RUNW::Zygote::Request &Req) {
+    auto &VM = *Selected->VM;
+    const auto &Bundle = State.bundle();
+    initHostModules(VM, Bundle, RootPath, WasmPath);
+    if (auto Res = RUNW::AOTCache::acquire(SoPath, Req.ContainerRoot); !Res) {
+      return EXIT_FAILURE;
+    }
+    EntryLock = RUNW::AOTCache::Lock();
+    return runContainer(VM, Req.ContainerId, Req.PidFile, State,
+                        Req.ContainerRoot / "state.json"sv, Req.ExecFifoFd,
+                        SoPath, Selected->Restored ? ""sv : Selected->Init);
+  };
+
+  if (auto Res = RUNW::Zygote::serve(Prepare, Run); !Res) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/// Container run by a host, prepared by Prepare and run by Run
+struct HostedInstance {
+  WasmEdge::VM::VM VM;
+  RUNW::State State;
+  std::filesystem::path SoPath;
+  /// Initialization export to run before _start, empty once restored
+  std::string Init;
+
+  explicit HostedInstance(const WasmEdge::Configure &Conf) : VM(Conf) {}
+};
+
+/// Cgroup the cgroupsPath of a container is part of with the other
+/// containers of its pod: the slice of a systemd path, the parent directory
+/// of any other.
+std::string_view podCGroup(std::string_view CgroupsPath) noexcept {
+  if (const auto Colon = CgroupsPath.find(':');
+      Colon != std::string_view::npos) {
+    return CgroupsPath.substr(0, Colon);
+  }
+  const auto Slash = CgroupsPath.rfind('/');
+  return Slash == std::string_view::npos ? std::string_view{}
+                                         : CgroupsPath.substr(0, Slash);
+}
+
+/// Whether the bundle asks for nothing but namespaces the host is in. The
+/// instances of a host are threads, so they cannot have any of their own.
+bool sharesNamespaces(const RUNW::Bundle &Bundle) {
+  for (const auto &Desc : Bundle.linuxNamespaces()) {
+    if (Desc.Path.empty()) {
+      spdlog::info("container needs a {} namespace of its own"sv, Desc.Type);
+      return false;
+    }
+    std::string Own = "/proc/self/ns/"s;
+    Own += Desc.Type == "mount"sv     ? "mnt"sv
+           : Desc.Type == "network"sv ? "net"sv
+                                      : std::string_view(Desc.Type);
+    struct stat OwnStat, PathStat;
+    if (stat(Own.c_str(), &OwnStat) < 0 ||
+        stat(Desc.Path.c_str(), &PathStat) < 0 ||
+        OwnStat.st_dev != PathStat.st_dev ||
+        OwnStat.st_ino != PathStat.st_ino) {
+      spdlog::info("container joins {}, not the namespace of the host"sv,
+                   Desc.Path);
+      return false;
+    }
+  }
+  return true;
+}
+
+int doHost(std::string_view Name) {
+  const auto Conf = createConfigure(true);
+  // The pod the host runs the containers of, set by the first one
+  std::mutex BindMutex;
+  std::optional<std::pair<std::string, std::string>> Binding;
+
+  auto &&Prepare =
+      [&Conf, &BindMutex,
+       &Binding](const RUNW::Host::Request &Req) -> std::shared_ptr<void> {
+    auto Instance = std::make_shared<HostedInstance>(Conf);
+    auto &State = Instance->State;
+    if (!State.load(Req.ContainerRoot / "state.json"sv, Req.ConfigFileName)) {
+      spdlog::error("load state of {} failed"sv, Req.ContainerId);
+      return nullptr;
+    }
+    const auto &Bundle = State.bundle();
+    if (Bundle.args().empty() || !sharesNamespaces(Bundle)) {
+      return nullptr;
+    }
+    {
+      std::pair<std::string, std::string> Pod(
+          Bundle.sandboxId(), podCGroup(Bundle.linuxCgroupsPath()));
+      std::lock_guard Lock(BindMutex);
+      if (!Binding) {
+        spdlog::info("host bound to sandbox {} in cgroup {}"sv, Pod.first,
+                     Pod.second);
+        Binding = std::move(Pod);
+      } else if (*Binding != Pod) {
+        spdlog::info("{} is not in the pod of the host"sv, Req.ContainerId);
+        return nullptr;
+      }
+    }
+    auto RootPath = std::filesystem::u8path(Bundle.rootPath());
+    if (RootPath.is_relative()) {
+      RootPath = std::filesystem::u8path(State.bundlePath()) / RootPath;
+    }
+    auto Cwd = RootPath;
+    Cwd += std::filesystem::u8path(Bundle.cwd());
+    const auto WasmPath = Cwd / std::filesystem::u8path(Bundle.args()[0]);
+
+    // Modules that are not compiled yet take the regular create path
+    RUNW::AOTCache::Lock EntryLock;
+    if (auto Res = RUNW::AOTCache::lookup(WasmPath, Conf, EntryLock)) {
+      Instance->SoPath = std::move(*Res);
+    } else {
+      spdlog::info("{} is not compiled yet"sv, WasmPath);
+      return nullptr;
+    }
+
+    auto &VM = Instance->VM;
+    initHostModules(VM, Bundle, RootPath, WasmPath);
+    if (auto Res =
+            VM.loadWasm(RUNW::AOTCache::locate(Instance->SoPath, Conf));
+        !Res) {
+      return nullptr;
+    }
+    if (auto Res = VM.validate(); !Res) {
+      return nullptr;
+    }
+    if (auto Res = VM.instantiate(); !Res) {
+      return nullptr;
+    }
+    if (bool Restored; !restoreSnapshot(VM, Bundle.snapshotInit(),
+                                        Instance->SoPath, Restored)) {
+      return nullptr;
+    } else if (!Restored) {
+      Instance->Init = Bundle.snapshotInit();
+    }
+    if (auto Res = RUNW::AOTCache::acquire(Instance->SoPath, Req.ContainerRoot);
+        !Res) {
+      return nullptr;
+    }
+    return Instance;
+  };
+
+  auto &&Run = [](const RUNW::Host::Request &Req, void *Prepared) {
+    auto &Instance = *static_cast<HostedInstance *>(Prepared);
+    return runContainer(Instance.VM, Req.ContainerId, Req.PidFile,
+                        Instance.State, Req.ContainerRoot / "state.json"sv,
+                        Req.ExecFifoFd, Instance.SoPath, Instance.Init, 0,
+                        true, true);
+  };
+
+  auto &&Stop = [](void *Prepared) {
+    static_cast<HostedInstance *>(Prepared)->VM.stop();
+  };
+
+  auto &&Kill = [](const RUNW::Host::Request &Req, int ExitCode) {
+    const auto StateFile = Req.ContainerRoot / "state.json"sv;
+    RUNW::State State;
+    if (!State.load(StateFile, Req.ConfigFileName)) {
+      spdlog::error("load state of {} failed"sv, Req.ContainerId);
+      return;
+    }
+    State.setStopped(ExitCode);
+    if (!atomicUpdateFile(StateFile,
+                          [&](auto &Stream) { State.print(Stream); })) {
+      spdlog::error("state file update failed"sv);
+    }
+  };
+
+  if (auto Res = RUNW::Host::serve(Name, Prepare, Run, Stop, Kill); !Res) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int doCompileServer(uint32_t Jobs,
+                    const RUNW::CGroup::Resources &CompileLimits) {
+  if (Jobs == 0) {
+    cpu_set_t Set;
+    Jobs = sched_getaffinity(0, sizeof(Set), &Set) < 0 ? 1 : CPU_COUNT(&Set);
+  }
+
+  const auto Conf = createConfigure();
+  if (auto Res = RUNW::CompileServer::serve(
+          Jobs,
+          [&Conf, &CompileLimits](const std::filesystem::path &WasmPath) {
+            return precompileModule(Conf, WasmPath, CompileLimits);
+          });
+      !Res) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int run(int Argc, const char *Argv[]);
+
+int doDaemon() {
+  if (auto Res = RUNW::Daemon::serve(run); !Res) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/// Parse the command line and run it.
+int run(int Argc, const char *Argv[]) {
+  {
+    auto MainArgs = std::vector(Argv, Argv + Argc);
+    spdlog::info("MainArgs:"sv);
+    for (auto &Arg : MainArgs) {
+      spdlog::info("\tArg: {}", Arg);
+    }
+  }
+
+  RUNW::Options Opts;
+  if (!Opts.parse(Argc, Argv)) {
+    return EXIT_FAILURE;
+  }
+
+  if (Opts.Parser.isVersion()) {
+    std::cout << Argv[0] << " version "sv << RUNW::kVersionString << '\n';
+    return EXIT_SUCCESS;
+  }
+
+  const auto CompileLimits = Opts.compileLimits();
+
+  if (Opts.Create.is_selected()) {
+    return doCreate(Opts.Root.value(), Opts.SystemdCgroup.value(),
+                    Opts.ConfigFileName.value(), Opts.ContainerId.value(),
+                    Opts.Path.value(), Opts.ConsoleSocket.value(),
+                    Opts.PidFile.value(), Opts.UseServices.value(),
+                    CompileLimits);
+  } else if (Opts.isLifecycle()) {
+    return RUNW::Lifecycle::command(Opts);
+  } else if (Opts.Cache.is_selected()) {
+    return doCache(Opts.Root.value(), Opts.CacheAction.value(),
+                   Opts.MaxSize.value(), Opts.HotSize.value());
+  } else if (Opts.Precompile.is_selected()) {
+    return doPrecompile(Opts.PrecompilePaths.value(),
+                        Opts.ConfigFileName.value(), Opts.Jobs.value(),
+                        Opts.HottestFirst.value(), CompileLimits);
+  } else if (Opts.Snapshot.is_selected()) {
+    return doSnapshot(Opts.SnapshotBundle.value(), Opts.ConfigFileName.value());
+  } else if (Opts.Zygote.is_selected()) {
+    return doZygote(Opts.MaxInstances.value());
+  } else if (Opts.Host.is_selected()) {
+    return doHost(Opts.HostName.value());
+  } else if (Opts.CompileServer.is_selected()) {
+    return doCompileServer(Opts.Jobs.value(), CompileLimits);
+  } else if (Opts.Daemon.is_selected()) {
+    return doDaemon();
+  }
+
+  Opts.Parser.help();
+  return EXIT_FAILURE;
+}
+
+} // namespace
+
+int main(int Argc, const char *Argv[]) {
+  std::ios::sync_with_stdio(false);
+  auto FileLogger = spdlog::basic_logger_mt("file_logger", kLogFile);
+  spdlog::set_default_logger(FileLogger);
+  WasmEdge::Log::setDebugLoggingLevel();
+
+  return run(Argc, Argv);
+}
@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#define ELPP_STL_LOGGING
+
+#include "zygote.h"
+#include "config.h"
+#include "pidfd.h"
+#include "unixsocket.h"
+#include <array>
+#include <boost/scope_exit.hpp>
+#include <common/log.h>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace RUNW {
+
+namespace {
+
+const std::string_view kSocketName = "zygote.sock"sv;
+
+// Stdin, stdout, stderr and the exec fifo of the create
+constexpr const size_t kFdCount = 4;
+constexpr const size_t kMaxRequestSize = 16384;
+
+void reapChildren(int) noexcept {
+  const int Err = errno;
+  while (waitpid(-1, nullptr, WNOHANG) > 0) {
+  }
+  errno = Err;
+}
+
+/// Receive a request and the fds that come with it. Fds is filled even when
+/// the request is malformed, so the caller can close them.
+bool receiveRequest(int Fd, Zygote::Request &Req,
+                    std::array<int, kFdCount> &Fds) noexcept {
+  Fds.fill(-1);
+  std::vector<char> Buffer(kMaxRequestSize);
+  alignas(cmsghdr) char Control[CMSG_SPACE(sizeof(int) * kFdCount)];
+  iovec Iov = {Buffer.data(), Buffer.size()};
+  msghdr Msg = {};
+  Msg.msg_iov = &Iov;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+
+  ssize_t Size;
+  do {
+    Size = recvmsg(Fd, &Msg, MSG_CMSG_CLOEXEC);
+  } while (Size < 0 && errno == EINTR);
+  if (Size <= 0) {
+    return false;
+  }
+  for (cmsghdr *Cmsg = CMSG_FIRSTHDR(&Msg); Cmsg != nullptr;
+       Cmsg = CMSG_NXTHDR(&Msg, Cmsg)) {
+    if (Cmsg->cmsg_level == SOL_SOCKET && Cmsg->cmsg_type == SCM_RIGHTS &&
+        Cmsg->cmsg_len == CMSG_LEN(sizeof(int) * kFdCount)) {
+      std::memcpy(Fds.data(), CMSG_DATA(Cmsg), sizeof(int) * kFdCount);
+    }
+  }
+  if ((Msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || Fds.back() < 0) {
+    return false;
+  }
+
+  // Fields are terminated by '\0'
+  std::array<std::string_view, 4> Fields;
+  std::string_view Rest(Buffer.data(), Size);
+  for (auto &Field : Fields) {
+    const auto End = Rest.find('\0');
+    if (End == std::string_view::npos) {
+      return false;
+    }
+    Field = Rest.substr(0, End);
+    Rest.remove_prefix(End + 1);
+  }
+  Req.ContainerRoot = std::filesystem::u8path(Fields[0]);
+  Req.ContainerId = Fields[1];
+  Req.PidFile = Fields[2];
+  Req.ConfigFileName = Fields[3];
+  Req.ExecFifoFd = Fds[3];
+  return true;
+}
+
+void reply(int Fd, bool Success) noexcept {
+  const char Status = Success ? '0' : '1';
+  send(Fd, &Status, sizeof(Status), MSG_NOSIGNAL);
+}
+
+} // namespace
+
+std::filesystem::path Zygote::socketPath() {
+  return std::filesystem::u8path(kStateDir) / kSocketName;
+}
+
+cxx20::expected<void, int> Zygote::serve(PrepareFunc Prepare,
+                                         RunFunc Run) noexcept {
+  const auto Path = socketPath();
+  struct sigaction Action = {};
+  Action.sa_handler = reapChildren;
+  Action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigemptyset(&Action.sa_mask);
+  if (sigaction(SIGCHLD, &Action, nullptr) < 0) {
+    spdlog::error("sigaction failed: {}"sv, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+
+  if (std::error_code ErrCode;
+      std::filesystem::create_directories(Path.parent_path(), ErrCode),
+      ErrCode) {
+    spdlog::error("create {} failed: {}"sv, Path.parent_path(),
+                  ErrCode.message());
+    return cxx20::unexpected(ErrCode.value());
+  }
+
+  int ListenFd;
+  if (auto Res = UnixSocket::listen(Path, SOCK_SEQPACKET)) {
+    ListenFd = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&ListenFd, &Path) {
+    close(ListenFd);
+    unlink(Path.c_str());
+  };
+  spdlog::info("zygote listening on {}"sv, Path);
+
+  while (true) {
+    const int Fd = accept4(ListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (Fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      spdlog::error("accept failed: {}"sv, std::strerror(errno));
+      return cxx20::unexpected(errno);
+    }
+    // Requests name the bundle, config and pid file a root fork acts on
+    if (!UnixSocket::trustedPeer(Fd)) {
+      close(Fd);
+      continue;
+    }
+
+    Request Req;
+    std::array<int, kFdCount> Fds;
+    const bool Received = receiveRequest(Fd, Req, Fds);
+    BOOST_SCOPE_EXIT_ALL(&Fd, &Fds) {
+      for (const int ReceivedFd : Fds) {
+        if (ReceivedFd >= 0) {
+          close(ReceivedFd);
+        }
+      }
+      close(Fd);
+    };
+    if (!Received) {
+      spdlog::error("malformed zygote request"sv);
+      continue;
+    }
+    if (!Prepare(Req)) {
+      reply(Fd, false);
+      continue;
+    }
+
+    // Keep the container unreaped until its pidfd is open
+    sigset_t ChildMask, OldMask;
+    sigemptyset(&ChildMask);
+    sigaddset(&ChildMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &ChildMask, &OldMask);
+    const pid_t Pid = fork();
+    if (Pid < 0) {
+      spdlog::error("fork failed: {}"sv, std::strerror(errno));
+      sigprocmask(SIG_SETMASK, &OldMask, nullptr);
+      reply(Fd, false);
+      continue;
+    }
+    if (Pid == 0) {
+      signal(SIGCHLD, SIG_DFL);
+      sigprocmask(SIG_SETMASK, &OldMask, nullptr);
+      close(ListenFd);
+      close(Fd);
+      for (int StdFd = 0; StdFd < 3; ++StdFd) {
+        if (Fds[StdFd] != StdFd) {
+          dup2(Fds[StdFd], StdFd);
+          close(Fds[StdFd]);
+        }
+      }
+      if (setsid() < 0) {
+        _Exit(EXIT_FAILURE);
+      }
+      exit(Run(Req));
+    }
+    spdlog::info("forked container {} as {}"sv, Req.ContainerId, Pid);
+    PidFd::track(Pid, Req.ContainerRoot);
+    sigprocmask(SIG_SETMASK, &OldMask, nullptr);
+    reply(Fd, true);
+  }
+}
+
+cxx20::expected<void, int> Zygote::request(const Request &Req) noexcept {
+  int Fd;
+  if (auto Res = UnixSocket::connect(socketPath(), SOCK_SEQPACKET)) {
+    Fd = *Res;
+  } else {
+    return cxx20::unexpected(Res.error());
+  }
+  BOOST_SCOPE_EXIT_ALL(&Fd) { close(Fd); };
+
+  std::string Message;
+  std::error_code ErrCode;
+  for (const auto &Field :
+       {std::filesystem::absolute(Req.ContainerRoot, ErrCode).u8string(),
+        Req.ContainerId,
+        std::filesystem::absolute(std::filesystem::u8path(Req.PidFile),
+                                  ErrCode)
+            .u8string(),
+        Req.ConfigFileName}) {
+    Message += Field;
+    Message += '\0';
+  }
+  if (ErrCode || Message.size() > kMaxRequestSize) {
+    return cxx20::unexpected(EINVAL);
+  }
+
+  const std::array<int, kFdCount> Fds = {STDIN_FILENO, STDOUT_FILENO,
+                                         STDERR_FILENO, Req.ExecFifoFd};
+  alignas(cmsghdr) char Control[CMSG_SPACE(sizeof(int) * kFdCount)] = {};
+  iovec Iov = {Message.data(), Message.size()};
+  msghdr Msg = {};
+  Msg.msg_iov = &Iov;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+  cmsghdr *Cmsg = CMSG_FIRSTHDR(&Msg);
+  Cmsg->cmsg_level = SOL_SOCKET;
+  Cmsg->cmsg_type = SCM_RIGHTS;
+  Cmsg->cmsg_len = CMSG_LEN(sizeof(int) * kFdCount);
+  std::memcpy(CMSG_DATA(Cmsg), Fds.data(), sizeof(int) * kFdCount);
+
+  ssize_t Size;
+  do {
+    Size = sendmsg(Fd, &Msg, MSG_NOSIGNAL);
+  } while (Size < 0 && errno == EINTR);
+  if (Size < 0) {
+    spdlog::error("send zygote request failed: {}"sv, std::strerror(errno));
+    return cxx20::unexpected(errno);
+  }
+
+  char Status;
+  do {
+    Size = read(Fd, &Status, sizeof(Status));
+  } while (Size < 0 && errno == EINTR);
+  if (Size != sizeof(Status) || Status != '0') {
+    spdlog::info("zygote cannot start {}"sv, Req.ContainerId);
+    return cxx20::unexpected(EAGAIN);
+  }
+  return {};
+}
+
+} // namespace RUNW